@@ -0,0 +1,120 @@
+#include "AllocTable.h"
+
+//empty slots hold this offset; real offsets are never negative
+static const int64_t EMPTY = -1;
+static const size_t INITIAL_SLOTS = 64;
+
+//Constructor; starts with a small power-of-two table
+AllocTable::AllocTable() {
+    mask = INITIAL_SLOTS - 1;
+    slots = new Slot[INITIAL_SLOTS];
+    count = 0;
+    clear();
+}
+
+//Destructor
+AllocTable::~AllocTable() {
+    delete[] slots;
+}
+
+//Forgets every entry but keeps the slots for reuse
+void AllocTable::clear() {
+    for (size_t i = 0; i <= mask; i++)
+        slots[i].offset = EMPTY;
+    count = 0;
+}
+
+//returns the length recorded for the block at wordOffset, -1 if there is none
+int64_t AllocTable::getSizeOffset(int64_t wordOffset) {
+    size_t i = home(wordOffset);
+    while (slots[i].offset != EMPTY) {
+        if (slots[i].offset == wordOffset)
+            return slots[i].length;
+        i = (i + 1) & mask;
+    }
+    return -1;
+}
+
+//records a new block; an existing entry at the same offset is overwritten
+void AllocTable::addEntry(int64_t length, int64_t offset) {
+    if ((size_t) (count + 1) * 2 > mask + 1)
+        grow();
+    size_t i = home(offset);
+    while (slots[i].offset != EMPTY && slots[i].offset != offset)
+        i = (i + 1) & mask;
+    if (slots[i].offset == EMPTY)
+        count++;
+    slots[i].offset = offset;
+    slots[i].length = length;
+}
+
+//removes the block at wordOffset, shifting later probes back so no tombstones are left
+void AllocTable::deleteEntry(int64_t wordOffset) {
+    size_t i = home(wordOffset);
+    while (slots[i].offset != wordOffset) {
+        if (slots[i].offset == EMPTY)
+            return;
+        i = (i + 1) & mask;
+    }
+    count--;
+
+    size_t hole = i;
+    size_t j = i;
+    while (true) {
+        j = (j + 1) & mask;
+        if (slots[j].offset == EMPTY)
+            break;
+        //an entry may move into the hole only if the hole lies between its home slot and j
+        size_t want = home(slots[j].offset);
+        if (((j - want) & mask) >= ((j - hole) & mask)) {
+            slots[hole] = slots[j];
+            hole = j;
+        }
+    }
+    slots[hole].offset = EMPTY;
+}
+
+//returns the number of live blocks
+int64_t AllocTable::getCount() {
+    return count;
+}
+
+//writes every live entry to out, which must hold getCount() slots, and returns how many were written
+int64_t AllocTable::copyEntries(Slot *out) {
+    int64_t written = 0;
+    for (size_t i = 0; i <= mask; i++)
+        if (slots[i].offset != EMPTY)
+            out[written++] = slots[i];
+    return written;
+}
+
+//grows the table ahead of a bulk insert so adding that many more entries never rehashes
+void AllocTable::reserve(int64_t entries) {
+    while ((size_t) (count + entries) * 2 > mask + 1)
+        grow();
+}
+
+//Fibonacci hash so neighbouring offsets spread across the table
+size_t AllocTable::home(int64_t wordOffset) {
+    uint64_t hash = (uint64_t) wordOffset * 0x9E3779B97F4A7C15ULL;
+    return (size_t) (hash ^ (hash >> 32)) & mask;
+}
+
+//doubles the table and reinserts every entry
+void AllocTable::grow() {
+    Slot *old = slots;
+    size_t oldSize = mask + 1;
+    mask = oldSize * 2 - 1;
+    slots = new Slot[oldSize * 2];
+    for (size_t i = 0; i <= mask; i++)
+        slots[i].offset = EMPTY;
+    for (size_t i = 0; i < oldSize; i++) {
+        if (old[i].offset == EMPTY)
+            continue;
+        size_t j = home(old[i].offset);
+        while (slots[j].offset != EMPTY)
+            j = (j + 1) & mask;
+        slots[j] = old[i];
+    }
+    delete[] old;
+}
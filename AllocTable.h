@@ -0,0 +1,35 @@
+#ifndef OFFICIALMEMORYMANAGER_ALLOCTABLE_H
+#define OFFICIALMEMORYMANAGER_ALLOCTABLE_H
+
+#include <cstdint>
+#include <cstddef>
+
+//open-addressed table of live blocks keyed by word offset
+class AllocTable {
+public:
+    struct Slot {
+        int64_t offset, length;
+    };
+
+public:
+    AllocTable();
+    ~AllocTable();
+    void clear();
+    int64_t getSizeOffset(int64_t wordOffset);
+    void addEntry(int64_t length, int64_t offset);
+    void deleteEntry(int64_t wordOffset);
+    int64_t getCount();
+    int64_t copyEntries(Slot *out);
+    void reserve(int64_t entries);
+
+private:
+    size_t home(int64_t wordOffset);
+    void grow();
+
+    Slot *slots;
+    size_t mask;
+    int64_t count;
+};
+
+
+#endif //OFFICIALMEMORYMANAGER_ALLOCTABLE_H
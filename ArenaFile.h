@@ -0,0 +1,59 @@
+#ifndef OFFICIALMEMORYMANAGER_ARENAFILE_H
+#define OFFICIALMEMORYMANAGER_ARENAFILE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <pthread.h>
+
+//File-backed arena layout: ArenaFileHeader, with ARENA_FILE_SHARED a SharedArenaSync padded to 64 bytes, then the
+//bitmap as (words + 63) / 64 64-bit words (bit set = word in use), then a second bitmap of the same size with a bit
+//set at the first word of every live block, then the arena's words * wordSize bytes at arenaOffset, a page
+//boundary. A block runs from its start bit to the next start bit or free word, so the two bitmaps are the
+//allocation records. Integers are in the writer's byte order.
+struct ArenaFileHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t byteOrder;
+    uint32_t wordSize;
+    uint32_t flags;
+    int64_t words;
+    uint64_t arenaOffset;
+};
+
+const char ARENA_FILE_MAGIC[4] = {'M', 'A', 'R', 'N'};
+const uint16_t ARENA_FILE_VERSION = 2;
+const uint16_t ARENA_FILE_BYTE_ORDER = 0x0102;
+
+//flags
+const uint32_t ARENA_FILE_SHARED = 1;
+
+//What a logged change did: Allocate and Free a block of length words at offset, Resize the block at offset to
+//length words; Reload, logged when a process died holding the lock, sends every process back to the bitmaps.
+enum class SharedChange : uint32_t { Allocate, Free, Resize, Reload };
+
+//one change to a shared arena, tagged with the generation it produced
+struct SharedArenaChange {
+    uint64_t generation;
+    int64_t offset;
+    int64_t length;
+    SharedChange change;
+};
+
+const uint64_t SHARED_LOG_ENTRIES = 1024;
+
+//Shared arenas: the process-shared, robust lock every attached process takes, a count bumped with every change so
+//a process can tell whether its view is current, and the last SHARED_LOG_ENTRIES changes, the one that produced
+//generation g at log[g % SHARED_LOG_ENTRIES], so a process that fell behind can replay them
+struct SharedArenaSync {
+    pthread_mutex_t lock;
+    uint64_t generation;
+    SharedArenaChange log[SHARED_LOG_ENTRIES];
+};
+
+//where the bitmaps start, past the header and any SharedArenaSync
+inline size_t arenaFileBitsOffset(uint32_t flags) {
+    return sizeof(ArenaFileHeader) + (flags & ARENA_FILE_SHARED ? (sizeof(SharedArenaSync) + 63) / 64 * 64 : 0);
+}
+
+
+#endif //OFFICIALMEMORYMANAGER_ARENAFILE_H
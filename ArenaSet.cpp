@@ -0,0 +1,151 @@
+#include <sched.h>
+#include <atomic>
+#include "ArenaSet.h"
+
+//Constructor; every arena starts with the same allocator function.
+ArenaSet::ArenaSet(unsigned wordSize, int arenaCount, std::function<int(int, void *)> allocator) {
+    wSize = wordSize;
+    count = arenaCount < 1 ? 1 : arenaCount;
+    arenas = new MemoryManager *[count];
+    for (int i = 0; i < count; i++) {
+        arenas[i] = new MemoryManager(wordSize, allocator);
+        arenas[i]->setThreadSafe(true);
+    }
+    memory = nullptr;
+    arenaBytes = 0;
+    memoryCap = 0;
+}
+
+//Constructor; every arena starts in the same built-in allocation mode.
+ArenaSet::ArenaSet(unsigned wordSize, int arenaCount, AllocatorMode allocatorMode)
+        : ArenaSet(wordSize, arenaCount, std::function<int(int, void *)>()) {
+    setAllocator(allocatorMode);
+}
+
+//Releases the arenas and the region they share.
+ArenaSet::~ArenaSet() {
+    shutdown();
+    for (int i = 0; i < count; i++)
+        delete arenas[i];
+    delete[] arenas;
+}
+
+//Allocates sizeInWords words and hands each arena an equal slice (the last one takes the remainder).
+//Each slice is bound by the same per-manager word limit (MAX_WORDS) as MemoryManager::initialize.
+//Returns false, with no arenas, if the size is invalid or the region cannot be allocated.
+bool ArenaSet::initialize(size_t sizeInWords) {
+    shutdown();
+    size_t arenaWords = sizeInWords / count;
+    size_t lastWords = sizeInWords - arenaWords * (count - 1);
+    if (lastWords > (size_t) MAX_WORDS) {
+        std::cout << "Invalid sizeInWords" << endl;
+        return false;
+    }
+
+    memory = new (std::nothrow) char[sizeInWords * wSize];
+    if (!memory)
+        return false;
+    memoryCap = sizeInWords * wSize;
+    arenaBytes = arenaWords * wSize;
+    for (int i = 0; i < count; i++) {
+        if (!arenas[i]->initialize(i == count - 1 ? lastWords : arenaWords, memory + i * arenaBytes)) {
+            shutdown();
+            return false;
+        }
+    }
+    return true;
+}
+
+//Shuts every arena down and releases the shared region.
+void ArenaSet::shutdown() {
+    if (!memory)
+        return;
+    for (int i = 0; i < count; i++)
+        arenas[i]->shutdown();
+    delete[] memory;
+    memory = nullptr;
+    arenaBytes = 0;
+    memoryCap = 0;
+}
+
+//Allocates from the calling thread's arena, trying the others in turn if it cannot fit the request.
+void *ArenaSet::allocate(size_t sizeInBytes) {
+    int home = homeArena();
+    for (int i = 0; i < count; i++) {
+        void *block = arenas[(home + i) % count]->allocate(sizeInBytes);
+        if (block)
+            return block;
+    }
+    return nullptr;
+}
+
+//Frees a block through the arena whose slice contains it.
+void ArenaSet::free(void *address) {
+    int arena = arenaOf(address);
+    if (arena != -1)
+        arenas[arena]->free(address);
+}
+
+//Sets the allocator function of every arena; use getArena to give one arena its own.
+void ArenaSet::setAllocator(std::function<int(int, void *)> allocator) {
+    for (int i = 0; i < count; i++)
+        arenas[i]->setAllocator(allocator);
+}
+
+//Sets the wide allocator function of every arena.
+void ArenaSet::setWideAllocator(std::function<int64_t(int64_t, void *)> allocator) {
+    for (int i = 0; i < count; i++)
+        arenas[i]->setWideAllocator(allocator);
+}
+
+//Sets the built-in allocation mode of every arena.
+void ArenaSet::setAllocator(AllocatorMode allocatorMode) {
+    for (int i = 0; i < count; i++)
+        arenas[i]->setAllocator(allocatorMode);
+}
+
+//Returns the index of the arena owning address, -1 if it is outside the region.
+int ArenaSet::arenaOf(void *address) {
+    char *index = (char *) address;
+    if (!memory || index < memory || index >= memory + memoryCap)
+        return -1;
+    if (arenaBytes == 0)
+        return count - 1;
+    size_t arena = (index - memory) / arenaBytes;
+    return arena >= (size_t) count ? count - 1 : (int) arena;
+}
+
+//Returns one arena, e.g. to give it its own allocator or to inspect its bitmap.
+MemoryManager *ArenaSet::getArena(int arena) {
+    return arena >= 0 && arena < count ? arenas[arena] : nullptr;
+}
+
+//Returns the number of arenas.
+int ArenaSet::getArenaCount() {
+    return count;
+}
+
+//Returns the word size used for alignment.
+unsigned ArenaSet::getWordSize() {
+    return wSize;
+}
+
+//Returns the start of the shared region.
+void *ArenaSet::getMemoryStart() {
+    return memory;
+}
+
+//Returns the byte limit of the shared region.
+size_t ArenaSet::getMemoryLimit() {
+    return memoryCap;
+}
+
+//the CPU the thread is running on picks its arena; threads get a stable index instead where that is unavailable
+int ArenaSet::homeArena() {
+    int cpu = sched_getcpu();
+    if (cpu >= 0)
+        return cpu % count;
+    static std::atomic<unsigned> nextThread(0);
+    thread_local unsigned index = nextThread++;
+    return (int) (index % count);
+}
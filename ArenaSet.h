@@ -0,0 +1,40 @@
+#ifndef OFFICIALMEMORYMANAGER_ARENASET_H
+#define OFFICIALMEMORYMANAGER_ARENASET_H
+
+#include "MemoryManager.h"
+
+//One managed region split into equal, independently locked arenas, each a thread-safe MemoryManager with its own
+//bitmap and allocation records. Threads allocate from the arena of the CPU they run on and spill to the others
+//when it is full; free() finds the owning arena from the address.
+class ArenaSet {
+public:
+    ArenaSet(unsigned wordSize, int arenaCount, std::function<int(int, void *)> allocator);
+    ArenaSet(unsigned wordSize, int arenaCount, AllocatorMode allocatorMode);
+    ~ArenaSet();
+    bool initialize(size_t sizeInWords);
+    void shutdown();
+    void *allocate(size_t sizeInBytes);
+    void free(void *address);
+    void setAllocator(std::function<int(int, void *)> allocator);
+    void setAllocator(AllocatorMode allocatorMode);
+    void setWideAllocator(std::function<int64_t(int64_t, void *)> allocator);
+    int arenaOf(void *address);
+    MemoryManager *getArena(int arena);
+    int getArenaCount();
+    unsigned getWordSize();
+    void *getMemoryStart();
+    size_t getMemoryLimit();
+
+private:
+    int homeArena();
+
+    unsigned wSize;
+    int count;
+    MemoryManager **arenas;
+    char *memory;
+    size_t arenaBytes;
+    size_t memoryCap;
+};
+
+
+#endif //OFFICIALMEMORYMANAGER_ARENASET_H
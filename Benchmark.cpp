@@ -0,0 +1,453 @@
+#include <chrono>
+#include <random>
+#include <thread>
+#include <sys/wait.h>
+#include "MemoryManager.h"
+#include "ArenaSet.h"
+
+using Clock = std::chrono::steady_clock;
+
+//one allocation policy under test: an allocator function, a wide allocator function or a built-in mode
+struct Policy {
+    const char *name;
+    std::function<int(int, void *)> allocator;
+    std::function<int64_t(int64_t, void *)> wideAllocator;
+    AllocatorMode mode;
+};
+
+//block sizes drawn by a run: uniform small, uniform up to 256 words, or mostly small with a long tail
+enum class Sizes { Small, Wide, Tail };
+
+static const char *sizesName(Sizes sizes) {
+    return sizes == Sizes::Small ? "small" : sizes == Sizes::Wide ? "wide" : "tail";
+}
+
+static int64_t drawWords(Sizes sizes, std::mt19937 &rng) {
+    if (sizes == Sizes::Small)
+        return 1 + rng() % 16;
+    if (sizes == Sizes::Wide)
+        return 1 + rng() % 256;
+    //one request in 16 is large, the rest small
+    return rng() % 16 ? 1 + rng() % 8 : 64 + rng() % 448;
+}
+
+//one line of output
+struct Result {
+    string scenario;
+    string policy;
+    size_t words;
+    string sizes;
+    size_t holes;
+    int threads;
+    double pairsPerSecond;
+    double allocate[3];
+    double free[3];
+    size_t failed;
+};
+
+//fills p50/p99/p999 from per-operation latencies in nanoseconds
+static void percentiles(vector<double> &samples, double out[3]) {
+    if (samples.empty()) {
+        out[0] = out[1] = out[2] = 0;
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    const double ranks[3] = {0.50, 0.99, 0.999};
+    for (int i = 0; i < 3; i++)
+        out[i] = samples[(size_t) (ranks[i] * (double) (samples.size() - 1))];
+}
+
+static double nanos(Clock::time_point from, Clock::time_point to) {
+    return std::chrono::duration<double, std::nano>(to - from).count();
+}
+
+//Fills the arena, then frees the first half of each of holeCount equal groups so the run starts half full with
+//holeCount holes. Then times random free/allocate pairs, one clock read around each call.
+static Result churn(Policy &policy, size_t words, Sizes sizes, size_t holeCount, int operations, unsigned seed) {
+    MemoryManager memoryManager(8, policy.mode);
+    if (policy.mode == AllocatorMode::Callback)
+        memoryManager.setAllocator(policy.allocator);
+    else if (policy.mode == AllocatorMode::WideCallback)
+        memoryManager.setWideAllocator(policy.wideAllocator);
+    memoryManager.initialize(words);
+
+    std::mt19937 rng(seed);
+    vector<void *> live;
+    for (;;) {
+        void *block = memoryManager.allocate(drawWords(sizes, rng) * 8);
+        if (!block)
+            block = memoryManager.allocate(8);
+        if (!block)
+            break;
+        live.push_back(block);
+    }
+    vector<void *> kept;
+    size_t group = std::max<size_t>(2, live.size() / std::max<size_t>(1, holeCount));
+    for (size_t i = 0; i < live.size(); i++) {
+        if (i % group < group / 2)
+            memoryManager.free(live[i]);
+        else
+            kept.push_back(live[i]);
+    }
+    live.swap(kept);
+
+    Result result{"churn", policy.name, words, sizesName(sizes), holeCount, 1};
+    vector<double> allocateNanos, freeNanos;
+    allocateNanos.reserve(operations);
+    freeNanos.reserve(operations);
+    size_t failed = 0;
+
+    auto start = Clock::now();
+    for (int i = 0; i < operations; i++) {
+        if (!live.empty()) {
+            size_t victim = rng() % live.size();
+            auto before = Clock::now();
+            memoryManager.free(live[victim]);
+            freeNanos.push_back(nanos(before, Clock::now()));
+            live[victim] = live.back();
+            live.pop_back();
+        }
+        size_t bytes = drawWords(sizes, rng) * 8;
+        auto before = Clock::now();
+        void *block = memoryManager.allocate(bytes);
+        allocateNanos.push_back(nanos(before, Clock::now()));
+        if (block)
+            live.push_back(block);
+        else
+            failed++;
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    memoryManager.shutdown();
+
+    result.pairsPerSecond = operations / elapsed;
+    percentiles(allocateNanos, result.allocate);
+    percentiles(freeNanos, result.free);
+    result.failed = failed;
+    return result;
+}
+
+//How threads share the allocator: one manager behind an outside mutex (how callers share a manager without
+//thread-safe mode), one manager with setThreadSafe(true), or an ArenaSet with an arena per thread.
+enum class Sharing { OutsideMutex, ThreadSafe, Arenas };
+
+static const char *sharingName(Sharing sharing) {
+    return sharing == Sharing::OutsideMutex ? "outside mutex" : sharing == Sharing::ThreadSafe ? "setThreadSafe"
+                                                                                                : "ArenaSet";
+}
+
+//Runs threadCount workers doing allocate/free pairs over a window of 64 blocks each.
+static Result contention(Sharing sharing, int threadCount, Sizes sizes, size_t words, int pairsPerThread) {
+    MemoryManager memoryManager(8, AllocatorMode::Tlsf);
+    ArenaSet arenaSet(8, threadCount, AllocatorMode::Tlsf);
+    if (sharing == Sharing::Arenas)
+        arenaSet.initialize(words);
+    else
+        memoryManager.initialize(words);
+    memoryManager.setThreadSafe(sharing == Sharing::ThreadSafe);
+    std::mutex outside;
+
+    vector<vector<double>> allocateNanos(threadCount), freeNanos(threadCount);
+    vector<size_t> failed(threadCount, 0);
+
+    auto allocateOne = [&](size_t bytes) -> void * {
+        if (sharing == Sharing::Arenas)
+            return arenaSet.allocate(bytes);
+        if (sharing == Sharing::OutsideMutex) {
+            std::lock_guard<std::mutex> guard(outside);
+            return memoryManager.allocate(bytes);
+        }
+        return memoryManager.allocate(bytes);
+    };
+    auto freeOne = [&](void *block) {
+        if (sharing == Sharing::Arenas)
+            arenaSet.free(block);
+        else if (sharing == Sharing::OutsideMutex) {
+            std::lock_guard<std::mutex> guard(outside);
+            memoryManager.free(block);
+        } else
+            memoryManager.free(block);
+    };
+
+    auto worker = [&](int t) {
+        std::mt19937 rng(100 + t);
+        void *window[64] = {};
+        allocateNanos[t].reserve(pairsPerThread);
+        freeNanos[t].reserve(pairsPerThread);
+        for (int i = 0; i < pairsPerThread; i++) {
+            int slot = i % 64;
+            if (window[slot]) {
+                auto before = Clock::now();
+                freeOne(window[slot]);
+                freeNanos[t].push_back(nanos(before, Clock::now()));
+            }
+            size_t bytes = drawWords(sizes, rng) * 8;
+            auto before = Clock::now();
+            window[slot] = allocateOne(bytes);
+            allocateNanos[t].push_back(nanos(before, Clock::now()));
+            if (!window[slot])
+                failed[t]++;
+        }
+    };
+
+    auto start = Clock::now();
+    vector<std::thread> threads;
+    for (int t = 0; t < threadCount; t++)
+        threads.emplace_back(worker, t);
+    for (auto &thread : threads)
+        thread.join();
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    if (sharing == Sharing::Arenas)
+        arenaSet.shutdown();
+    else
+        memoryManager.shutdown();
+
+    Result result{"threads", sharingName(sharing), words, sizesName(sizes), 0, threadCount};
+    result.pairsPerSecond = threadCount * (double) pairsPerThread / elapsed;
+    vector<double> allAllocate, allFree;
+    for (int t = 0; t < threadCount; t++) {
+        allAllocate.insert(allAllocate.end(), allocateNanos[t].begin(), allocateNanos[t].end());
+        allFree.insert(allFree.end(), freeNanos[t].begin(), freeNanos[t].end());
+        result.failed += failed[t];
+    }
+    percentiles(allAllocate, result.allocate);
+    percentiles(allFree, result.free);
+    return result;
+}
+
+//How rebuild reloads an arena: loadSnapshot, which derives the hole index from the restored bits, or attaching a
+//file-backed arena, which also rebuilds the records from its block start bits
+enum class Reload { Snapshot, ArenaFile };
+
+//Times rebuilding the hole index of a words-word arena with holeCount holes from its bits, the path the BitScan
+//kernels serve (the policy column names the kernel set; BITSCAN_KERNEL=scalar|sse2 picks a narrower one). In these
+//rows pairs/s counts reloads per second and the allocate column is reload latency; free is unused.
+static Result rebuild(Reload reload, size_t words, size_t holeCount, int repeats) {
+    char filename[] = "/tmp/benchArenaXXXXXX";
+    int fd = mkstemp(filename);
+    if (fd != -1)
+        close(fd);
+    unlink(filename);
+
+    MemoryManager memoryManager(8, AllocatorMode::FirstFit);
+    if (reload == Reload::Snapshot)
+        memoryManager.initialize(words);
+    else
+        memoryManager.initialize(filename, words, false);
+    //a few large blocks, so the scan over the bits rather than the records dominates
+    size_t blockWords = std::max<size_t>(1, words / (2 * holeCount));
+    vector<void *> blocks;
+    for (size_t i = 0; i < 2 * holeCount; i++)
+        blocks.push_back(memoryManager.allocate(blockWords * 8));
+    for (size_t i = 0; i < blocks.size(); i += 2)
+        memoryManager.free(blocks[i]);
+    if (reload == Reload::Snapshot)
+        memoryManager.saveSnapshot(filename, false);
+    memoryManager.shutdown();
+
+    MemoryManager reloaded(8, AllocatorMode::FirstFit);
+    vector<double> reloadNanos;
+    reloadNanos.reserve(repeats);
+    size_t failed = 0;
+    auto start = Clock::now();
+    for (int i = 0; i < repeats; i++) {
+        auto before = Clock::now();
+        bool loaded = reload == Reload::Snapshot ? reloaded.loadSnapshot(filename)
+                                                 : reloaded.initialize(filename, 0, false);
+        reloadNanos.push_back(nanos(before, Clock::now()));
+        if (!loaded)
+            failed++;
+        reloaded.shutdown();
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    unlink(filename);
+
+    string name = string(reload == Reload::Snapshot ? "snapshot/" : "file/") + BitScan::kernelName();
+    Result result{"rebuild", name, words, "-", holeCount, 1};
+    result.pairsPerSecond = repeats / elapsed;
+    percentiles(reloadNanos, result.allocate);
+    result.free[0] = result.free[1] = result.free[2] = 0;
+    result.failed = failed;
+    return result;
+}
+
+//Two processes attached to one shared arena of words words and holeCount holes take turns doing an allocate/free
+//pair, so every turn starts with replaying the changes the other process made. Latencies are the parent's; the
+//allocate column includes that replay.
+static Result alternating(size_t words, size_t holeCount, int pairs) {
+    string name = "/benchShared" + std::to_string(getpid());
+    MemoryManager::unlinkShared(name.c_str());
+    int toChild[2], toParent[2];
+    if (pipe(toChild) != 0 || pipe(toParent) != 0)
+        return Result{"shared", "alternating", words, "-", holeCount, 2, 0, {0, 0, 0}, {0, 0, 0}, (size_t) pairs};
+
+    MemoryManager setup(8, AllocatorMode::FirstFit);
+    setup.initializeShared(name.c_str(), words);
+    size_t blockWords = std::max<size_t>(1, words / (2 * holeCount));
+    vector<void *> blocks;
+    for (size_t i = 0; i < 2 * holeCount; i++)
+        blocks.push_back(setup.allocate(blockWords * 8));
+    for (size_t i = 0; i < blocks.size(); i += 2)
+        setup.free(blocks[i]);
+    setup.shutdown();
+
+    bool isChild = fork() == 0;
+    int in = isChild ? toChild[0] : toParent[0];
+    int out = isChild ? toParent[1] : toChild[1];
+    MemoryManager memoryManager(8, AllocatorMode::FirstFit);
+    memoryManager.initializeShared(name.c_str(), 0);
+
+    vector<double> allocateNanos, freeNanos;
+    allocateNanos.reserve(pairs);
+    freeNanos.reserve(pairs);
+    size_t failed = 0;
+    char token = 0;
+    auto start = Clock::now();
+    for (int i = 0; i < pairs; i++) {
+        if (isChild && read(in, &token, 1) != 1)
+            break;
+        auto before = Clock::now();
+        void *block = memoryManager.allocate(64);
+        auto between = Clock::now();
+        memoryManager.free(block);
+        auto after = Clock::now();
+        allocateNanos.push_back(nanos(before, between));
+        freeNanos.push_back(nanos(between, after));
+        if (block == nullptr)
+            failed++;
+        if (write(out, &token, 1) != 1 || (!isChild && read(in, &token, 1) != 1))
+            break;
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    if (isChild)
+        _exit(0);
+    wait(nullptr);
+    memoryManager.shutdown();
+    MemoryManager::unlinkShared(name.c_str());
+    for (int fd : {toChild[0], toChild[1], toParent[0], toParent[1]})
+        close(fd);
+
+    Result result{"shared", "alternating", words, "-", holeCount, 2};
+    result.pairsPerSecond = pairs / elapsed;
+    percentiles(allocateNanos, result.allocate);
+    percentiles(freeNanos, result.free);
+    result.failed = failed;
+    return result;
+}
+
+static void printTable(const vector<Result> &results) {
+    std::cout << std::left << std::setw(9) << "scenario" << std::setw(16) << "policy" << std::setw(10) << "words"
+              << std::setw(7) << "sizes" << std::setw(7) << "holes" << std::setw(9) << "threads"
+              << std::setw(12) << "pairs/s" << std::setw(27) << "allocate ns p50/p99/p999"
+              << std::setw(23) << "free ns p50/p99/p999" << "failed" << std::endl;
+    for (auto &r : results) {
+        auto triple = [](const double values[3]) {
+            return to_string((long) values[0]) + "/" + to_string((long) values[1]) + "/" + to_string((long) values[2]);
+        };
+        std::cout << std::left << std::setw(9) << r.scenario << std::setw(16) << r.policy << std::setw(10) << r.words
+                  << std::setw(7) << r.sizes << std::setw(7) << r.holes << std::setw(9) << r.threads
+                  << std::setw(12) << std::fixed << std::setprecision(0) << r.pairsPerSecond
+                  << std::setw(27) << triple(r.allocate) << std::setw(23) << triple(r.free) << r.failed << std::endl;
+    }
+}
+
+static void printCsv(const vector<Result> &results) {
+    std::cout << "scenario,policy,words,sizes,holes,threads,pairs_per_s,allocate_p50_ns,allocate_p99_ns,"
+                 "allocate_p999_ns,free_p50_ns,free_p99_ns,free_p999_ns,failed" << std::endl;
+    for (auto &r : results)
+        std::cout << r.scenario << "," << r.policy << "," << r.words << "," << r.sizes << "," << r.holes << ","
+                  << r.threads << "," << std::fixed << std::setprecision(0) << r.pairsPerSecond << ","
+                  << r.allocate[0] << "," << r.allocate[1] << "," << r.allocate[2] << ","
+                  << r.free[0] << "," << r.free[1] << "," << r.free[2] << "," << r.failed << std::endl;
+}
+
+static void printJson(const vector<Result> &results) {
+    std::cout << "[" << std::endl;
+    for (size_t i = 0; i < results.size(); i++) {
+        auto &r = results[i];
+        std::cout << "  {\"scenario\": \"" << r.scenario << "\", \"policy\": \"" << r.policy
+                  << "\", \"words\": " << r.words << ", \"sizes\": \"" << r.sizes << "\", \"holes\": " << r.holes
+                  << ", \"threads\": " << r.threads << std::fixed << std::setprecision(0)
+                  << ", \"pairs_per_s\": " << r.pairsPerSecond
+                  << ", \"allocate_ns\": {\"p50\": " << r.allocate[0] << ", \"p99\": " << r.allocate[1]
+                  << ", \"p999\": " << r.allocate[2] << "}, \"free_ns\": {\"p50\": " << r.free[0]
+                  << ", \"p99\": " << r.free[1] << ", \"p999\": " << r.free[2] << "}, \"failed\": " << r.failed
+                  << "}" << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+    std::cout << "]" << std::endl;
+}
+
+//usage: bench [--csv | --json] [--quick]
+int main(int argc, char **argv) {
+    enum { Table, Csv, Json } format = Table;
+    bool quick = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--csv")
+            format = Csv;
+        else if (arg == "--json")
+            format = Json;
+        else if (arg == "--quick")
+            quick = true;
+        else {
+            std::cerr << "usage: " << argv[0] << " [--csv | --json] [--quick]" << std::endl;
+            return 2;
+        }
+    }
+    int operations = quick ? 20000 : 200000;
+
+    vector<Policy> policies = {
+            {"bestFit",        bestFit,  nullptr,      AllocatorMode::Callback},
+            {"worstFit",       worstFit, nullptr,      AllocatorMode::Callback},
+            {"firstFit",       firstFit, nullptr,      AllocatorMode::Callback},
+            {"bestFitWide",    nullptr,  bestFitWide,  AllocatorMode::WideCallback},
+            {"worstFitWide",   nullptr,  worstFitWide, AllocatorMode::WideCallback},
+            {"firstFitWide",   nullptr,  firstFitWide, AllocatorMode::WideCallback},
+            {"Mode::BestFit",  nullptr,  nullptr,      AllocatorMode::BestFit},
+            {"Mode::WorstFit", nullptr,  nullptr,      AllocatorMode::WorstFit},
+            {"Mode::FirstFit", nullptr,  nullptr,      AllocatorMode::FirstFit},
+            {"Mode::NextFit",  nullptr,  nullptr,      AllocatorMode::NextFit},
+            {"Mode::Tlsf",     nullptr,  nullptr,      AllocatorMode::Tlsf},
+            {"Mode::Buddy",    nullptr,  nullptr,      AllocatorMode::Buddy},
+    };
+    size_t arenaWords[] = {4096, 65536, 1 << 20};
+    size_t holeCounts[] = {1, 64, 1024};
+    Sizes distributions[] = {Sizes::Small, Sizes::Wide, Sizes::Tail};
+
+    vector<Result> results;
+    for (auto &policy : policies) {
+        bool callback = policy.mode == AllocatorMode::Callback || policy.mode == AllocatorMode::WideCallback;
+        for (size_t words : arenaWords) {
+            if (policy.mode == AllocatorMode::Callback && words > (size_t) LEGACY_MAX_WORDS)
+                continue;
+            for (size_t holeCount : holeCounts) {
+                if (holeCount * 8 > words)
+                    continue;
+                for (Sizes sizes : distributions) {
+                    //the callbacks rescan the whole hole list on every call; keep their largest runs short
+                    int runOperations = callback && words * holeCount > 65536 * 64 ? operations / 20 : operations;
+                    results.push_back(churn(policy, words, sizes, holeCount, runOperations, 42));
+                }
+            }
+        }
+    }
+
+    int maxThreads = (int) std::max(4u, std::thread::hardware_concurrency());
+    for (Sharing sharing : {Sharing::OutsideMutex, Sharing::ThreadSafe, Sharing::Arenas})
+        for (int threadCount = 1; threadCount <= maxThreads; threadCount *= 2)
+            for (Sizes sizes : {Sizes::Small, Sizes::Tail})
+                results.push_back(contention(sharing, threadCount, sizes, 65536, operations));
+
+    for (Reload reload : {Reload::Snapshot, Reload::ArenaFile})
+        for (size_t words : {(size_t) 1 << 20, (size_t) 1 << 24})
+            results.push_back(rebuild(reload, words, 64, quick ? 5 : 50));
+    for (size_t words : {(size_t) 1 << 16, (size_t) 1 << 22})
+        results.push_back(alternating(words, 64, quick ? 200 : 2000));
+
+    if (format == Csv)
+        printCsv(results);
+    else if (format == Json)
+        printJson(results);
+    else
+        printTable(results);
+    return 0;
+}
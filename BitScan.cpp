@@ -0,0 +1,191 @@
+#include <cstring>
+#include <cstdlib>
+#include "BitScan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BITSCAN_X86 1
+#endif
+
+//Each kernel set works on whole words: countUsed over [0, wordCount), skip returns the first index in [from, to)
+//whose word is not value, or to.
+struct BitScanKernels {
+    const char *name;
+    int64_t (*countUsed)(const uint64_t *words, int64_t wordCount);
+    int64_t (*skip)(const uint64_t *words, int64_t from, int64_t to, uint64_t value);
+};
+
+static int64_t countUsedScalar(const uint64_t *words, int64_t wordCount) {
+    int64_t used = 0;
+    for (int64_t i = 0; i < wordCount; i++)
+        used += __builtin_popcountll(words[i]);
+    return used;
+}
+
+static int64_t skipScalar(const uint64_t *words, int64_t from, int64_t to, uint64_t value) {
+    while (from < to && words[from] == value)
+        from++;
+    return from;
+}
+
+#ifdef BITSCAN_X86
+
+//per-byte popcount by nibble lookup, summed into the four 64-bit lanes
+__attribute__((target("avx2")))
+static inline __m256i popcount256(__m256i v) {
+    const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                           0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    __m256i low = _mm256_shuffle_epi8(table, _mm256_and_si256(v, nibble));
+    __m256i high = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+    return _mm256_sad_epu8(_mm256_add_epi8(low, high), _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+static inline int64_t sum256(__m256i v) {
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *) lanes, v);
+    return (int64_t) (lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+}
+
+__attribute__((target("avx2")))
+static int64_t countUsedAvx2(const uint64_t *words, int64_t wordCount) {
+    __m256i total = _mm256_setzero_si256();
+    int64_t i = 0;
+    for (; i + 4 <= wordCount; i += 4)
+        total = _mm256_add_epi64(total, popcount256(_mm256_loadu_si256((const __m256i *) (words + i))));
+    return sum256(total) + countUsedScalar(words + i, wordCount - i);
+}
+
+__attribute__((target("avx2")))
+static int64_t skipAvx2(const uint64_t *words, int64_t from, int64_t to, uint64_t value) {
+    const __m256i match = _mm256_set1_epi64x((long long) value);
+    for (; from + 4 <= to; from += 4) {
+        __m256i equal = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *) (words + from)), match);
+        unsigned mask = (unsigned) _mm256_movemask_epi8(equal);
+        if (mask != 0xFFFFFFFFu)
+            return from + __builtin_ctz(~mask) / 8;
+    }
+    return skipScalar(words, from, to, value);
+}
+
+//per-byte popcount by bit slicing, summed into the two 64-bit lanes
+__attribute__((target("sse2")))
+static inline __m128i popcount128(__m128i v) {
+    __m128i x = _mm_sub_epi8(v, _mm_and_si128(_mm_srli_epi16(v, 1), _mm_set1_epi8(0x55)));
+    x = _mm_add_epi8(_mm_and_si128(x, _mm_set1_epi8(0x33)), _mm_and_si128(_mm_srli_epi16(x, 2), _mm_set1_epi8(0x33)));
+    x = _mm_and_si128(_mm_add_epi8(x, _mm_srli_epi16(x, 4)), _mm_set1_epi8(0x0F));
+    return _mm_sad_epu8(x, _mm_setzero_si128());
+}
+
+__attribute__((target("sse2")))
+static inline int64_t sum128(__m128i v) {
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *) lanes, v);
+    return (int64_t) (lanes[0] + lanes[1]);
+}
+
+__attribute__((target("sse2")))
+static int64_t countUsedSse2(const uint64_t *words, int64_t wordCount) {
+    __m128i total = _mm_setzero_si128();
+    int64_t i = 0;
+    for (; i + 2 <= wordCount; i += 2)
+        total = _mm_add_epi64(total, popcount128(_mm_loadu_si128((const __m128i *) (words + i))));
+    return sum128(total) + countUsedScalar(words + i, wordCount - i);
+}
+
+//SSE2 has no 64-bit compare; a word matches when both of its 32-bit halves do
+__attribute__((target("sse2")))
+static int64_t skipSse2(const uint64_t *words, int64_t from, int64_t to, uint64_t value) {
+    const __m128i match = _mm_set1_epi64x((long long) value);
+    for (; from + 2 <= to; from += 2) {
+        __m128i equal = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (words + from)), match);
+        unsigned mask = (unsigned) _mm_movemask_epi8(equal);
+        if (mask != 0xFFFFu)
+            return from + ((mask & 0xFFu) == 0xFFu ? 1 : 0);
+    }
+    return skipScalar(words, from, to, value);
+}
+
+#endif
+
+//Picks the widest kernels the CPU runs. BITSCAN_KERNEL=scalar|sse2|avx2 forces a narrower (or the same) set,
+//for comparing them.
+static BitScanKernels chooseKernels() {
+    const char *forced = getenv("BITSCAN_KERNEL");
+    BitScanKernels chosen = {"scalar", countUsedScalar, skipScalar};
+    if (forced && strcmp(forced, "scalar") == 0)
+        return chosen;
+#ifdef BITSCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        chosen = {"sse2", countUsedSse2, skipSse2};
+    if (forced && strcmp(forced, "sse2") == 0)
+        return chosen;
+    if (__builtin_cpu_supports("avx2"))
+        chosen = {"avx2", countUsedAvx2, skipAvx2};
+#endif
+    return chosen;
+}
+
+static const BitScanKernels &kernels() {
+    static const BitScanKernels chosen = chooseKernels();
+    return chosen;
+}
+
+//returns the number of set bits in the first wordCount words
+int64_t BitScan::countUsed(const uint64_t *words, int64_t wordCount) {
+    return wordCount > 0 ? kernels().countUsed(words, wordCount) : 0;
+}
+
+//Finds the first free run starting at or after from among the first bits bits, returning it as [begin, end).
+//Whole used or whole free words are skipped by the vector kernels; returns false if there is no such run.
+bool BitScan::nextRun(const uint64_t *words, int64_t bits, int64_t from, int64_t &begin, int64_t &end) {
+    if (from < 0)
+        from = 0;
+    if (from >= bits)
+        return false;
+    int64_t wordCount = (bits + 63) / 64;
+
+    int64_t i = from >> 6;
+    uint64_t freeBits = ~words[i] & (~0ULL << (from & 63));
+    if (!freeBits) {
+        i = kernels().skip(words, i + 1, wordCount, ~0ULL);
+        if (i == wordCount)
+            return false;
+        freeBits = ~words[i];
+    }
+    begin = i * 64 + __builtin_ctzll(freeBits);
+    if (begin >= bits)
+        return false;
+
+    uint64_t usedBits = words[i] & (~0ULL << (begin & 63));
+    if (!usedBits) {
+        i = kernels().skip(words, i + 1, wordCount, 0);
+        if (i == wordCount) {
+            end = bits;
+            return true;
+        }
+        usedBits = words[i];
+    }
+    end = i * 64 + __builtin_ctzll(usedBits);
+    if (end > bits)
+        end = bits;
+    return true;
+}
+
+//writes the first bytes bytes of the map, bit i of the map landing in bit i % 8 of byte i / 8
+void BitScan::pack(const uint64_t *words, int64_t bytes, uint8_t *out) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    //the words already sit in memory in export order
+    memcpy(out, words, (size_t) bytes);
+#else
+    for (int64_t i = 0; i < bytes; i++)
+        out[i] = (uint8_t) (words[i >> 3] >> ((i & 7) * 8));
+#endif
+}
+
+//name of the kernel set in use: "avx2", "sse2" or "scalar"
+const char *BitScan::kernelName() {
+    return kernels().name;
+}
@@ -0,0 +1,17 @@
+#ifndef OFFICIALMEMORYMANAGER_BITSCAN_H
+#define OFFICIALMEMORYMANAGER_BITSCAN_H
+
+#include <cstdint>
+
+//Whole-map kernels over a packed bitmap (bit i of word i / 64 set = word in use). On x86-64 the AVX2 or SSE2
+//versions are picked once at run time from what the CPU supports; other targets use the scalar versions.
+class BitScan {
+public:
+    static int64_t countUsed(const uint64_t *words, int64_t wordCount);
+    static bool nextRun(const uint64_t *words, int64_t bits, int64_t from, int64_t &begin, int64_t &end);
+    static void pack(const uint64_t *words, int64_t bytes, uint8_t *out);
+    static const char *kernelName();
+};
+
+
+#endif //OFFICIALMEMORYMANAGER_BITSCAN_H
@@ -0,0 +1,79 @@
+#include "Buddy.h"
+
+//Constructor; starts with no free blocks
+Buddy::Buddy() {
+    clear();
+}
+
+//Forgets every free block
+void Buddy::clear() {
+    for (auto &freeList : freeLists)
+        freeList.clear();
+}
+
+//Returns the block size used for a request of length words (the next power of two), -1 if it cannot be served.
+int64_t Buddy::roundUp(int64_t length) {
+    if (length <= 0 || length > (1LL << (ORDER_COUNT - 1)))
+        return -1;
+    int order = 0;
+    while ((1LL << order) < length)
+        order++;
+    return 1LL << order;
+}
+
+//Returns the offset of a 2^order block holding length words, splitting a larger block if needed, or -1.
+int64_t Buddy::allocate(int64_t length) {
+    int64_t size = roundUp(length);
+    if (size == -1)
+        return -1;
+    int order = __builtin_ctzll(size);
+
+    int from = order;
+    while (from < ORDER_COUNT && freeLists[from].empty())
+        from++;
+    if (from == ORDER_COUNT)
+        return -1;
+
+    int64_t offset = *freeLists[from].begin();
+    freeLists[from].erase(freeLists[from].begin());
+    //keep the low half each time and hand the high half back as a free buddy
+    while (from > order) {
+        from--;
+        freeLists[from].insert(offset + (1LL << from));
+    }
+    return offset;
+}
+
+//Frees an arbitrary range by splitting it into the largest aligned power-of-two blocks it contains.
+void Buddy::addFree(int64_t length, int64_t offset) {
+    while (length > 0) {
+        int order = offset == 0 ? ORDER_COUNT - 1 : __builtin_ctzll(offset);
+        while (order > 0 && (1LL << order) > length)
+            order--;
+        freeBlock(order, offset);
+        offset += 1LL << order;
+        length -= 1LL << order;
+    }
+}
+
+//Forgets every free block inside [offset, offset + length), for a range taken without going through allocate.
+void Buddy::takeRange(int64_t length, int64_t offset) {
+    for (auto &freeList : freeLists) {
+        auto block = freeList.lower_bound(offset);
+        while (block != freeList.end() && *block < offset + length)
+            block = freeList.erase(block);
+    }
+}
+
+//frees one aligned block, merging with its buddy for as long as the buddy is free too
+void Buddy::freeBlock(int order, int64_t offset) {
+    while (order < ORDER_COUNT - 1) {
+        auto buddy = freeLists[order].find(offset ^ (1LL << order));
+        if (buddy == freeLists[order].end())
+            break;
+        freeLists[order].erase(buddy);
+        offset &= ~(1LL << order);
+        order++;
+    }
+    freeLists[order].insert(offset);
+}
@@ -0,0 +1,29 @@
+#ifndef OFFICIALMEMORYMANAGER_BUDDY_H
+#define OFFICIALMEMORYMANAGER_BUDDY_H
+
+#include <set>
+#include <cstdint>
+
+//Binary buddy system over word offsets: blocks are 2^order words aligned to their size, one free list per order.
+//A block's buddy is offset ^ (1 << order), so freeing merges upwards while the buddy is also free.
+class Buddy {
+public:
+    static const int ORDER_COUNT = 63;
+
+public:
+    Buddy();
+    void clear();
+    static int64_t roundUp(int64_t length);
+    int64_t allocate(int64_t length);
+    void addFree(int64_t length, int64_t offset);
+    void takeRange(int64_t length, int64_t offset);
+
+private:
+    void freeBlock(int order, int64_t offset);
+
+    //free block offsets per order, lowest first so placement is deterministic
+    std::set<int64_t> freeLists[ORDER_COUNT];
+};
+
+
+#endif //OFFICIALMEMORYMANAGER_BUDDY_H
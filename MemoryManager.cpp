@@ -1,121 +1,1421 @@
 #include <iostream>
 #include <utility>
+#include <atomic>
+#include <chrono>
+#include <charconv>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <cerrno>
+#include <sys/uio.h>
 #include "MemoryManager.h"
 
+//each thread gets a stable index the first time it uses any manager; with no more threads than slots none share
+static int threadSlot() {
+    static std::atomic<unsigned> nextThread(0);
+    thread_local unsigned index = nextThread++;
+    return (int) (index % ThreadCache::SLOTS);
+}
+static_assert(Metrics::SHARDS == ThreadCache::SLOTS, "metrics are sharded by thread slot");
+
+//true for one call in Metrics::SAMPLE_EVERY on this thread
+static bool sampleLatency() {
+    thread_local unsigned calls = 0;
+    return ++calls % Metrics::SAMPLE_EVERY == 0;
+}
+
+static uint64_t nanosSince(std::chrono::steady_clock::time_point start) {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
 //Constructor; sets native word size (in bytes, for alignment) and default allocator for finding a memory hole.
 MemoryManager::MemoryManager(unsigned wordSize, std::function<int(int, void *)> allocator) {
     wSize = wordSize;
     alloc = std::move(allocator);
-    memLinkedlist = new LinkedList;
+    mode = AllocatorMode::Callback;
+    memTable = new AllocTable;
     bMap = new MyBitMap;
+    tlsf = new Tlsf;
+    buddy = new Buddy;
+    nextFitCursor = 0;
+    threadSafe = false;
+    caches = nullptr;
+    cacheOwners = nullptr;
+    cachedBlocks = 0;
+    cachedWords = 0;
+    trace = nullptr;
+    metrics = new Metrics;
+    memoryChunk = nullptr;
+    memoryChunkCap = 0;
+    ownsChunk = false;
     valid = false;
+    arenaOptions = ArenaOptions{};
+    backing = ArenaBacking::None;
+    mappedBytes = 0;
+    pageBytes = 0;
+    fileMapping = nullptr;
+    fileBytes = 0;
+    arenaFile = -1;
+    blockStarts = nullptr;
+    readOnly = false;
+    sharedSync = nullptr;
+    seenGeneration = 0;
+    sharedLocked = false;
+
+}
 
+//Constructor; sets native word size and one of the built-in allocation modes instead of an allocator function.
+MemoryManager::MemoryManager(unsigned wordSize, AllocatorMode allocatorMode)
+        : MemoryManager(wordSize, std::function<int(int, void *)>()) {
+    mode = allocatorMode;
 }
 
 //Releases all memory allocated by this object without leaking memory.
 MemoryManager::~MemoryManager() {
-    if (memLinkedlist)
-        delete(memLinkedlist);
+    //a mapped arena gets its cached blocks back as free words, under the segment's lock if it is shared
+    if (valid && fileMapping) {
+        auto guard = lockCore();
+        clearArena();
+    }
+    if (memTable)
+        delete(memTable);
 
     if (valid) {
-        delete[] memoryChunk;
+        releaseChunk();
     }
     if (bMap) {
         if (valid){
             bMap->clear();
         }
-        delete [] bMap;
+        delete bMap;
     }
+    delete tlsf;
+    delete buddy;
+    delete[] caches;
+    delete cacheOwners;
+    delete trace;
+    delete metrics;
 }
 
-//Instantiates block of requested size, no larger than 65536 words; cleans up previous block if applicable.
-void MemoryManager::initialize(size_t sizeInWords) {
+//Instantiates block of requested size, no larger than MAX_WORDS; cleans up previous block if applicable.
+//Arenas above LEGACY_MAX_WORDS can only be used with the wide hole list, wide allocators and built-in modes.
+//Returns false, with no arena, if the size is invalid or the memory for it cannot be had.
+bool MemoryManager::initialize(size_t sizeInWords) {
+    return initialize(sizeInWords, nullptr);
+}
 
-    if (valid && bMap){
-        bMap->clear();
+//Manages sizeInWords words at memory, which the caller owns and must keep alive until shutdown.
+//With memory == nullptr the block is allocated (and later released) by the manager itself.
+bool MemoryManager::initialize(size_t sizeInWords, void *memory) {
+    auto guard = lockCore();
+
+    if (valid){
+        clearArena();
+    }
+
+    if(sizeInWords > (size_t) MAX_WORDS){
+        std::cout << "Invalid sizeInWords" << endl;
+        return false;
     }
 
-    if(sizeInWords >= 0 && sizeInWords <= 65536){
+    //running out of memory for the bitmap, arena or engine is reported with false, as the mapped paths do
+    try {
         //need to keep a track of the memory chunk
         bMap->setMyBitmap(sizeInWords);
-        memoryChunkCap = wSize *sizeInWords;
-        memoryChunk = new char [memoryChunkCap];
+        placeChunk(wSize * sizeInWords, memory);
         valid = true;
+        rebuildEngine();
+    } catch (const std::bad_alloc &) {
+        clearArena();
+        return false;
     }
-    else
-        std::cout << "Invalid sizeInWords" << endl;
+    if (trace)
+        trace->recordInitialize((int64_t) sizeInWords, (unsigned) wSize);
+    return true;
 }
 
 //Releases memory block acquired during initialization, if any.
 void MemoryManager::shutdown() {
-    if (memoryChunk){
-        delete[] memoryChunk;
-    }
+    auto guard = lockCore();
+    clearArena();
+}
 
-    memLinkedlist->clear();
+//drops the memory block and every record of it; caller holds the core lock
+void MemoryManager::clearArena() {
+    if (blockStarts && !readOnly)
+        flushCaches();
+    releaseChunk();
+
+    memTable->clear();
     bMap->clear();
+    tlsf->clear();
+    buddy->clear();
+    nextFitCursor = 0;
+    if (caches) {
+        for (int i = 0; i < ThreadCache::SLOTS; i++) {
+            std::lock_guard<std::mutex> slotGuard(caches[i].lock);
+            caches[i].owned.clear();
+            for (auto &bin : caches[i].bins)
+                bin.clear();
+        }
+        cacheOwners->clear();
+    }
+    cachedBlocks = 0;
+    cachedWords = 0;
     valid = false;
 
 }
 
+//Maps filename as the arena, creating it for sizeInWords words if it is missing or empty. The bitmap and block
+//records live in the shared mapping (see ArenaFile.h), so allocations are in the file as soon as they are made and
+//the next initialize of the file carries on from there; sizeInWords 0 takes the file's size. readOnlyView maps an
+//existing file for inspection, even while another process writes it: its holes and records are those at attach
+//time, and allocate and free do nothing. Only one writer can map a file at a time. Returns false, with no arena,
+//if the file cannot be opened or created, is not an arena file of this word size or holds a different size.
+bool MemoryManager::initialize(const char *filename, size_t sizeInWords, bool readOnlyView) {
+    auto guard = lockCore();
+    if (valid)
+        clearArena();
+    if (sizeInWords > (size_t) MAX_WORDS)
+        return false;
+
+    int fd = open(filename, readOnlyView ? O_RDONLY : O_RDWR | O_CREAT, 0644);
+    if (fd == -1)
+        return false;
+    //two writers would overwrite each other's records, so a writer holds an exclusive lock while attached
+    if ((!readOnlyView && flock(fd, LOCK_EX | LOCK_NB) != 0) || !mapArenaFile(fd, sizeInWords, readOnlyView, false)) {
+        close(fd);
+        return false;
+    }
+    arenaFile = fd;
+    try {
+        attachMapping(readOnlyView);
+    } catch (const std::bad_alloc &) {
+        clearArena();
+        return false;
+    }
+    return true;
+}
+
+//Attaches to the POSIX shared-memory arena name (a shm_open name such as "/pool"), creating it for sizeInWords
+//words if it does not exist yet; sizeInWords 0 only attaches. Every attached process allocates from the same words
+//under the process-shared lock in the segment and can free blocks another allocated. The segment sits at a
+//different address in each process, so pass blocks between them as word offsets (getWordOffset, getAddress).
+//Each process keeps its own hole index and records; when it takes the lock after other processes changed them it
+//replays their changes from the log in the segment, so taking turns costs in proportion to the changes rather than
+//the arena, and rebuilds from the segment's bitmaps only after falling SHARED_LOG_ENTRIES changes behind (see
+//syncShared). Thread caches are bypassed. The segment lasts until unlinkShared(name).
+//Returns false, with no arena, if the segment cannot be opened or created or does not match.
+bool MemoryManager::initializeShared(const char *name, size_t sizeInWords) {
+    auto guard = lockCore();
+    if (valid)
+        clearArena();
+    if (sizeInWords > (size_t) MAX_WORDS)
+        return false;
+
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+    if (fd == -1)
+        return false;
+    //the first process to get here lays the segment out while the others wait. The mapping outlives the descriptor
+    //and would keep the lock with it, so the lock is dropped explicitly.
+    bool mapped = flock(fd, LOCK_EX) == 0 && mapArenaFile(fd, sizeInWords, false, true);
+    flock(fd, LOCK_UN);
+    close(fd);
+    if (!mapped)
+        return false;
+
+    sharedSync = (SharedArenaSync *) (fileMapping + sizeof(ArenaFileHeader));
+    seenGeneration = sharedSync->generation;
+    lockShared();
+    try {
+        attachMapping(false);
+    } catch (const std::bad_alloc &) {
+        //releasing the mapping lets go of the segment's lock too
+        clearArena();
+        return false;
+    }
+    seenGeneration = sharedSync->generation;
+    unlockShared();
+    return true;
+}
+
+//Removes the shared arena name; processes still attached keep it until they shut down.
+bool MemoryManager::unlinkShared(const char *name) {
+    return shm_unlink(name) == 0;
+}
+
+//makes the arena mapped at fileMapping the current one, loading its holes and records from the bitmaps in it
+void MemoryManager::attachMapping(bool readOnlyView) {
+    ArenaFileHeader header;
+    memcpy(&header, fileMapping, sizeof header);
+    readOnly = readOnlyView;
+    auto *bits = (uint64_t *) (fileMapping + arenaFileBitsOffset(header.flags));
+    bMap->attachBits((size_t) header.words, bits);
+    blockStarts = bits + (header.words + 63) / 64;
+    loadBlockStarts();
+    memoryChunk = fileMapping + header.arenaOffset;
+    memoryChunkCap = (size_t) header.words * wSize;
+    ownsChunk = false;
+    backing = ArenaBacking::File;
+    valid = true;
+    rebuildEngine();
+    if (trace)
+        trace->recordInitialize(header.words, (unsigned) wSize);
+}
+
+//Takes the shared arena's lock, first bringing this process's view up to date if another process has changed the
+//arena. A process that died holding the lock may have left one block half recorded and unlogged; the bitmaps still
+//describe the arena, so the lock is marked consistent and a Reload sends every process back to them.
+void MemoryManager::lockShared() {
+    if (pthread_mutex_lock(&sharedSync->lock) == EOWNERDEAD) {
+        pthread_mutex_consistent(&sharedSync->lock);
+        logChange(SharedChange::Reload, 0, 0);
+    }
+    sharedLocked = true;
+    if (sharedSync->generation != seenGeneration)
+        syncShared();
+}
+
+//releases the shared arena's lock, unless it went with the arena
+void MemoryManager::unlockShared() {
+    if (sharedSync && sharedLocked) {
+        sharedLocked = false;
+        pthread_mutex_unlock(&sharedSync->lock);
+    }
+}
+
+//Brings the records, holes and engine up to the shared arena's generation; caller holds the segment's lock. The
+//changes made since seenGeneration are replayed from the log, in time proportional to them; only when the log no
+//longer holds them all (more than SHARED_LOG_ENTRIES behind) or after a Reload is everything rebuilt from the
+//bitmaps, in time proportional to the arena.
+void MemoryManager::syncShared() {
+    uint64_t generation = sharedSync->generation;
+    bool replay = generation - seenGeneration <= SHARED_LOG_ENTRIES;
+    for (uint64_t g = seenGeneration + 1; replay && g <= generation; g++) {
+        const SharedArenaChange &entry = sharedSync->log[g % SHARED_LOG_ENTRIES];
+        replay = entry.generation == g && entry.change != SharedChange::Reload;
+    }
+    if (replay) {
+        for (uint64_t g = seenGeneration + 1; g <= generation; g++)
+            replayChange(sharedSync->log[g % SHARED_LOG_ENTRIES]);
+    } else {
+        auto *bits = (uint64_t *) bMap->getBits();
+        int64_t words = bMap->getRange();
+        memTable->clear();
+        bMap->clear();
+        bMap->attachBits((size_t) words, bits);
+        loadBlockStarts();
+        rebuildEngine();
+    }
+    seenGeneration = generation;
+}
+
+//Applies one change another process made to the records, hole index and engine. The shared bitmap already holds
+//it and possibly later changes, which are replayed next, so rewriting its bits here leaves it as it was.
+void MemoryManager::replayChange(const SharedArenaChange &entry) {
+    int64_t offset = entry.offset;
+    int64_t length = entry.length;
+    if (entry.change == SharedChange::Allocate) {
+        takeFromEngine(length, offset);
+        bMap->append(length, offset);
+        memTable->addEntry(length, offset);
+    } else if (entry.change == SharedChange::Free) {
+        memTable->deleteEntry(offset);
+        bMap->release(length, offset);
+        returnToEngine(length, offset);
+    } else if (entry.change == SharedChange::Resize) {
+        int64_t before = memTable->getSizeOffset(offset);
+        if (length < before) {
+            bMap->release(before - length, offset + length);
+            returnToEngine(before - length, offset + length);
+        } else if (length > before) {
+            takeFromEngine(length - before, offset + before);
+            bMap->append(length - before, offset + before);
+        }
+        memTable->deleteEntry(offset);
+        memTable->addEntry(length, offset);
+    }
+}
+
+//Maps the arena file open on fd into fileMapping, first laying out an empty arena of sizeInWords words if the
+//file is empty; shared lays it out with a SharedArenaSync and only accepts such files. Returns false if the file is
+//not one this manager can use.
+bool MemoryManager::mapArenaFile(int fd, size_t sizeInWords, bool readOnlyView, bool shared) {
+    struct stat status;
+    if (fstat(fd, &status) != 0)
+        return false;
+    ArenaFileHeader header{};
+    bool created = status.st_size == 0;
+    if (created) {
+        if (readOnlyView || sizeInWords == 0)
+            return false;
+        size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+        header.flags = shared ? ARENA_FILE_SHARED : 0;
+        size_t metadataBytes = arenaFileBitsOffset(header.flags) + 2 * ((sizeInWords + 63) / 64) * sizeof(uint64_t);
+        memcpy(header.magic, ARENA_FILE_MAGIC, sizeof header.magic);
+        header.version = ARENA_FILE_VERSION;
+        header.byteOrder = ARENA_FILE_BYTE_ORDER;
+        header.wordSize = (uint32_t) wSize;
+        header.words = (int64_t) sizeInWords;
+        header.arenaOffset = (metadataBytes + pageSize - 1) / pageSize * pageSize;
+        //the new file reads as zeros, which is an arena with nothing allocated; the header goes in once it is sized
+        status.st_size = (off_t) (header.arenaOffset + sizeInWords * wSize);
+        if (ftruncate(fd, status.st_size) != 0 || pwrite(fd, &header, sizeof header, 0) != (ssize_t) sizeof header)
+            return false;
+    } else if ((size_t) status.st_size < sizeof header || pread(fd, &header, sizeof header, 0) != (ssize_t) sizeof header)
+        return false;
+
+    //a read-only view may inspect either kind; writers must use the locking the arena was laid out for
+    bool sharedFile = header.flags & ARENA_FILE_SHARED;
+    if (memcmp(header.magic, ARENA_FILE_MAGIC, sizeof header.magic) != 0 || header.version != ARENA_FILE_VERSION ||
+        header.byteOrder != ARENA_FILE_BYTE_ORDER || header.wordSize != wSize || header.words <= 0 ||
+        header.words > MAX_WORDS || (sizeInWords != 0 && header.words != (int64_t) sizeInWords) ||
+        (!readOnlyView && sharedFile != shared) ||
+        header.arenaOffset < arenaFileBitsOffset(header.flags) + 2 * (size_t) ((header.words + 63) / 64) * sizeof(uint64_t) ||
+        (size_t) status.st_size != header.arenaOffset + (size_t) header.words * wSize)
+        return false;
+
+    void *mapping = mmap(nullptr, (size_t) status.st_size, readOnlyView ? PROT_READ : PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED)
+        return false;
+    fileMapping = (char *) mapping;
+    fileBytes = (size_t) status.st_size;
+
+    if (created && shared) {
+        //robust, so a process dying with the lock held leaves it recoverable rather than held forever
+        auto *sync = (SharedArenaSync *) (fileMapping + sizeof header);
+        pthread_mutexattr_t attributes;
+        pthread_mutexattr_init(&attributes);
+        pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&sync->lock, &attributes);
+        pthread_mutexattr_destroy(&attributes);
+        sync->generation = 0;
+    }
+    return true;
+}
+
+//Rebuilds the allocation records of a file-backed arena from its block start bits in one pass over both bitmaps:
+//a block ends at the next start bit or the first free word after it. A start bit on a free word, left by a writer
+//that died freeing a block, is dropped (cleared too unless the view is read-only) so it cannot split a block
+//later allocated over it. Caller holds the core lock.
+void MemoryManager::loadBlockStarts() {
+    int64_t words = bMap->getRange();
+    int64_t bitmapWords = (words + 63) / 64;
+    const uint64_t *used = bMap->getBits();
+    memTable->reserve(BitScan::countUsed(blockStarts, bitmapWords));
+
+    //the first free word at or after the block being recorded, found again only once a block starts past it
+    int64_t freeBegin = -1, freeEnd;
+    int64_t start = -1;
+    auto record = [&](int64_t limit) {
+        if (freeBegin < start && !BitScan::nextRun(used, words, start, freeBegin, freeEnd))
+            freeBegin = words;
+        int64_t end = std::min(limit, freeBegin);
+        if (end > start)
+            memTable->addEntry(end - start, start);
+        else if (!readOnly)
+            blockStarts[start >> 6] &= ~(1ULL << (start & 63));
+    };
+    for (int64_t i = 0; i < bitmapWords; i++) {
+        for (uint64_t bits = blockStarts[i]; bits; bits &= bits - 1) {
+            int64_t next = i * 64 + __builtin_ctzll(bits);
+            if (start != -1)
+                record(next);
+            start = next;
+        }
+    }
+    if (start != -1)
+        record(words);
+}
+
+//keeps a file-backed arena's block start bits in step with the records and logs the change for processes sharing
+//the arena; called once the used bits hold it
+void MemoryManager::markBlock(SharedChange change, int64_t wordOffset, int64_t length) {
+    if (!blockStarts)
+        return;
+    uint64_t bit = 1ULL << (wordOffset & 63);
+    if (change == SharedChange::Free)
+        blockStarts[wordOffset >> 6] &= ~bit;
+    else
+        blockStarts[wordOffset >> 6] |= bit;
+    if (sharedSync) {
+        logChange(change, wordOffset, length);
+        seenGeneration = sharedSync->generation;
+    }
+}
+
+//appends a change to the shared arena's log and bumps the generation it produced; caller holds the segment's lock
+void MemoryManager::logChange(SharedChange change, int64_t wordOffset, int64_t length) {
+    uint64_t generation = sharedSync->generation + 1;
+    SharedArenaChange &entry = sharedSync->log[generation % SHARED_LOG_ENTRIES];
+    entry.offset = wordOffset;
+    entry.length = length;
+    entry.change = change;
+    entry.generation = generation;
+    sharedSync->generation = generation;
+}
+
+//Takes bytes at memory as the arena, or allocates them when memory is nullptr; caller holds the core lock
+void MemoryManager::placeChunk(size_t bytes, void *memory) {
+    memoryChunkCap = bytes;
+    ownsChunk = memory == nullptr;
+    if (ownsChunk)
+        memoryChunk = acquireChunk(memoryChunkCap);
+    else {
+        memoryChunk = (char *) memory;
+        backing = ArenaBacking::External;
+    }
+}
+
+//size of the system's default huge page, from /proc/meminfo where there is one
+static size_t hugePageBytes() {
+    static const size_t bytes = [] {
+        size_t kilobytes = 2048;
+        if (FILE *meminfo = fopen("/proc/meminfo", "r")) {
+            char line[128];
+            while (fgets(line, sizeof line, meminfo))
+                if (sscanf(line, "Hugepagesize: %zu kB", &kilobytes) == 1)
+                    break;
+            fclose(meminfo);
+        }
+        return kilobytes * 1024;
+    }();
+    return bytes;
+}
+
+//Allocates bytes for the arena as the arena options ask, stepping down from reserved huge pages to plain mapped
+//pages to new char[] as the system refuses; records what it got in backing.
+char *MemoryManager::acquireChunk(size_t bytes) {
+    mappedBytes = 0;
+    pageBytes = (size_t) sysconf(_SC_PAGESIZE);
+    if (arenaOptions.mapped && bytes > 0) {
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_HUGETLB
+        if (arenaOptions.hugePages) {
+            //Huge page mappings are whole huge pages long. They are always reserved up front: without the
+            //reservation mmap succeeds on an empty pool and the first touch dies of SIGBUS instead.
+            size_t hugeBytes = (bytes + hugePageBytes() - 1) / hugePageBytes() * hugePageBytes();
+            void *chunk = mmap(nullptr, hugeBytes, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+            if (chunk != MAP_FAILED) {
+                mappedBytes = hugeBytes;
+                pageBytes = hugePageBytes();
+                backing = ArenaBacking::HugePages;
+                return (char *) chunk;
+            }
+        }
+#endif
+#ifdef MAP_NORESERVE
+        if (arenaOptions.lazyCommit)
+            flags |= MAP_NORESERVE;
+#endif
+        void *chunk = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (chunk != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+            //no reserved huge pages to be had, so hint for transparent ones; ignored where THP is off
+            if (arenaOptions.hugePages)
+                madvise(chunk, bytes, MADV_HUGEPAGE);
+#endif
+            mappedBytes = bytes;
+            backing = ArenaBacking::Mapped;
+            return (char *) chunk;
+        }
+    }
+    backing = ArenaBacking::Heap;
+    return new char [bytes];
+}
+
+//gives back the arena acquireChunk allocated, if the manager owns it, or unmaps a file-backed one
+void MemoryManager::releaseChunk() {
+    if (fileMapping) {
+        //the lock lives in the mapping, so it is let go first; the guard that took it then has nothing to release
+        if (sharedSync)
+            unlockShared();
+        else if (!readOnly)
+            msync(fileMapping, fileBytes, MS_SYNC);
+        munmap(fileMapping, fileBytes);
+        if (arenaFile != -1)
+            close(arenaFile);
+        sharedSync = nullptr;
+        fileMapping = nullptr;
+        fileBytes = 0;
+        arenaFile = -1;
+        blockStarts = nullptr;
+        readOnly = false;
+    }
+    if (memoryChunk && ownsChunk) {
+        if (mappedBytes)
+            munmap(memoryChunk, mappedBytes);
+        else
+            delete[] memoryChunk;
+    }
+    memoryChunk = nullptr;
+    mappedBytes = 0;
+    backing = ArenaBacking::None;
+}
+
+//Hands the whole pages inside a freed run of at least releaseBytes back to the system, so the arena's resident
+//size follows what is in use; they read as zeros when next touched. Caller holds the core lock.
+void MemoryManager::returnPages(int64_t length, int64_t wordOffset) {
+    if (!mappedBytes || !arenaOptions.releaseBytes || (size_t) length * wSize < arenaOptions.releaseBytes)
+        return;
+    uintptr_t begin = (uintptr_t) (memoryChunk + wordOffset * wSize);
+    uintptr_t end = begin + length * wSize;
+    begin = (begin + pageBytes - 1) / pageBytes * pageBytes;
+    end = end / pageBytes * pageBytes;
+    if (begin < end)
+        madvise((void *) begin, end - begin, MADV_DONTNEED);
+}
+
 //Allocates a memory using the allocator function. If no memory is available or size is invalid, returns nullptr.
 void *MemoryManager::allocate(size_t sizeInBytes) {
-    void * myList =  getList();
-    int output = alloc((int)ceil((double)sizeInBytes / wSize), myList);
-    delete static_cast<uint16_t*> (myList);
+    void *block;
+    if (sampleLatency()) {
+        auto start = std::chrono::steady_clock::now();
+        block = placeBlock(sizeInBytes);
+        metrics->recordAllocate(threadSlot(), nanosSince(start), block == nullptr);
+    } else {
+        block = placeBlock(sizeInBytes);
+        metrics->countAllocate(threadSlot(), block == nullptr);
+    }
+    if (trace)
+        trace->recordAllocate(sizeInBytes, block ? (int64_t) ((char *) block - memoryChunk) / (int64_t) wSize : -1);
+    return block;
+}
+
+//allocate without the bookkeeping around it
+void *MemoryManager::placeBlock(size_t sizeInBytes) {
+    int64_t sizeInWords = (int64_t) ((sizeInBytes + wSize - 1) / wSize);
+    if (threadSafe && !sharedSync && sizeInWords > 0 && sizeInWords <= ThreadCache::SMALL_WORDS)
+        return allocateCached(sizeInWords);
+
+    auto guard = lockCore();
+    int64_t output = allocateWords(sizeInWords);
 
     if (output == -1) {
         return nullptr;
     }
 
-    memLinkedlist->addList((int)ceil((double)sizeInBytes / wSize), output);
-    bMap->append((int)ceil((double)sizeInBytes / wSize), output);
-
     //location
-    return output * wSize + (char *) getMemoryStart();
+    return output * wSize + memoryChunk;
+}
+
+//places and records a block, returning its word offset or -1; caller holds the core lock
+int64_t MemoryManager::allocateWords(int64_t sizeInWords) {
+    if (readOnly)
+        return -1;
+    int64_t output = findHole(sizeInWords);
+    //the words missing may be small blocks parked in thread caches, so hand those back and look once more
+    if (output == -1 && cachedWords > 0) {
+        flushCaches();
+        output = findHole(sizeInWords);
+    }
+
+    if (output == -1) {
+        return -1;
+    }
+
+    //buddy blocks occupy the whole power of two, so the records and bitmap show the rounded size
+    if (mode == AllocatorMode::Buddy)
+        sizeInWords = Buddy::roundUp(sizeInWords);
+    memTable->addEntry(sizeInWords, output);
+    //used bits before the start bit, so a writer dying in between leaves no start bit on free words
+    bMap->append(sizeInWords, output);
+    markBlock(SharedChange::Allocate, output, sizeInWords);
+    if (mode == AllocatorMode::NextFit)
+        nextFitCursor = output + sizeInWords;
+    return output;
+}
+
+//Returns the word offset chosen for sizeInWords by the current allocation mode, -1 if there is no fit.
+int64_t MemoryManager::findHole(int64_t sizeInWords) {
+    //nothing fits past the largest hole, so fail before any list is built or allocator called; a buddy block
+    //needs room for its whole power of two
+    int64_t needed = mode == AllocatorMode::Buddy ? Buddy::roundUp(sizeInWords) : sizeInWords;
+    if (needed > bMap->largestHole())
+        return -1;
+
+    switch (mode) {
+        case AllocatorMode::BestFit:
+            return bMap->bestHole(sizeInWords);
+        case AllocatorMode::WorstFit:
+            return bMap->worstHole(sizeInWords);
+        case AllocatorMode::FirstFit:
+            return bMap->findFirstFit(sizeInWords);
+        case AllocatorMode::NextFit:
+            return bMap->findNextFit(sizeInWords, nextFitCursor);
+        case AllocatorMode::Tlsf:
+            return tlsf->allocate(sizeInWords);
+        case AllocatorMode::Buddy:
+            return buddy->allocate(sizeInWords);
+        case AllocatorMode::WideCallback:
+            //allocators read the bitmap's own list in place; it is only rebuilt after the holes change
+            return wideAlloc(sizeInWords, (void *) bMap->viewListWide());
+        default:
+            break;
+    }
+    //the 16-bit list cannot describe larger arenas or requests
+    if (bMap->getRange() > LEGACY_MAX_WORDS || sizeInWords > LEGACY_MAX_WORDS)
+        return -1;
+    //a request for all 65536 words fits only an empty arena, whose one hole the list has to split in two
+    if (sizeInWords > UINT16_MAX)
+        return bMap->getFreeWords() == sizeInWords ? 0 : -1;
+    return alloc((int) sizeInWords, (void *) bMap->viewList());
 }
 
 //Frees the memory block within the memory manager so that it can be reused.
 void MemoryManager::free(void *address) {
     char *index = (char *) address;
-    int wordOffset = (int) (index - (char *) getMemoryStart()) / wSize;
-    int length = memLinkedlist->getSizeOffset(wordOffset);
-    memLinkedlist->deleteList(wordOffset);
+    int64_t wordOffset = (int64_t) (index - memoryChunk) / (int64_t) wSize;
+    if (trace)
+        trace->recordFree(wordOffset);
+    if (sampleLatency()) {
+        auto start = std::chrono::steady_clock::now();
+        releaseBlock(wordOffset);
+        metrics->recordFree(threadSlot(), nanosSince(start));
+    } else {
+        releaseBlock(wordOffset);
+        metrics->countFree(threadSlot());
+    }
+}
+
+//free without the bookkeeping around it
+void MemoryManager::releaseBlock(int64_t wordOffset) {
+    if (readOnly)
+        return;
+    if (threadSafe && !sharedSync && freeCached(wordOffset))
+        return;
+
+    auto guard = lockCore();
+    if (threadSafe)
+        disownCached(wordOffset);
+    releaseWords(wordOffset);
+}
+
+//forgets the block at wordOffset and returns its words to the bitmap and engine; caller holds the core lock
+void MemoryManager::releaseWords(int64_t wordOffset) {
+    int64_t length = memTable->getSizeOffset(wordOffset);
+    if (length == -1)
+        return;
+    memTable->deleteEntry(wordOffset);
+    //start bit after the used bits, so a writer dying in between leaves a stale start bit the next load clears
+    //rather than used words no record covers
     bMap->release(length, wordOffset);
+    markBlock(SharedChange::Free, wordOffset, length);
+    returnToEngine(length, wordOffset);
+    returnPages(length, wordOffset);
 
 }
 
+//Resizes the block at address to newSizeInBytes, keeping its contents up to the smaller of the two sizes.
+//Shrinking hands the tail back where the block stands and growing takes the words right after it when they are
+//free, so only a block hemmed in by its neighbours is moved (allocate, copy, free). A nullptr address allocates
+//and a size of 0 frees. Returns the block's address, or nullptr with the block left as it was if it cannot grow.
+//An in-place resize is traced as a free and an allocation at the same offset.
+void *MemoryManager::reallocate(void *address, size_t newSizeInBytes) {
+    if (address == nullptr)
+        return allocate(newSizeInBytes);
+    if (newSizeInBytes == 0) {
+        free(address);
+        return nullptr;
+    }
+    int64_t wordOffset = (int64_t) ((char *) address - memoryChunk) / (int64_t) wSize;
+    int64_t sizeInWords = (int64_t) ((newSizeInBytes + wSize - 1) / wSize);
+    int64_t length;
+    bool resized;
+    {
+        auto guard = lockCore();
+        if (readOnly)
+            return nullptr;
+        resized = resizeWords(wordOffset, sizeInWords, length);
+    }
+    if (resized) {
+        if (trace) {
+            trace->recordFree(wordOffset);
+            trace->recordAllocate(newSizeInBytes, wordOffset);
+        }
+        return address;
+    }
+    if (length == -1)
+        return nullptr;
+
+    void *moved = allocate(newSizeInBytes);
+    if (moved == nullptr)
+        return nullptr;
+    memcpy(moved, address, (size_t) std::min(length, sizeInWords) * wSize);
+    free(address);
+    return moved;
+}
+
+//Resizes the live block at wordOffset to sizeInWords where it stands, returning false if it has to move; length
+//gets the block's current length, -1 if there is no such block. Caller holds the core lock.
+bool MemoryManager::resizeWords(int64_t wordOffset, int64_t sizeInWords, int64_t &length) {
+    length = memTable->getSizeOffset(wordOffset);
+    //blocks from the thread caches go back to bins by their length, so they always move
+    if (length == -1 || (threadSafe && cacheOwners->getSizeOffset(wordOffset) != -1))
+        return false;
+    //a buddy block stays its whole power of two, so it keeps its place for anything that still fits
+    if (mode == AllocatorMode::Buddy)
+        return Buddy::roundUp(sizeInWords) <= length;
+    if (sizeInWords == length)
+        return true;
+
+    if (sizeInWords < length) {
+        int64_t tail = wordOffset + sizeInWords;
+        bMap->release(length - sizeInWords, tail);
+        returnToEngine(length - sizeInWords, tail);
+        returnPages(length - sizeInWords, tail);
+    } else {
+        int64_t end = wordOffset + length;
+        int64_t extra = sizeInWords - length;
+        //the block is in use up to end, so a free run after it is a hole starting exactly there
+        auto hole = bMap->getHoles().find(end);
+        if (hole == bMap->getHoles().end() || hole->second < extra)
+            return false;
+        if (mode == AllocatorMode::Tlsf && !tlsf->takeAt(extra, end))
+            return false;
+        bMap->append(extra, end);
+    }
+    memTable->deleteEntry(wordOffset);
+    memTable->addEntry(sizeInWords, wordOffset);
+    //the start bit is already set; marking the block again tells processes sharing the arena its new size
+    markBlock(SharedChange::Resize, wordOffset, sizeInWords);
+    return true;
+}
+
+//hands released words back to the selected engine, if it keeps free lists of its own
+void MemoryManager::returnToEngine(int64_t length, int64_t wordOffset) {
+    if (mode == AllocatorMode::Tlsf)
+        tlsf->addFree(length, wordOffset);
+    else if (mode == AllocatorMode::Buddy)
+        buddy->addFree(length, wordOffset);
+}
+
+//Takes [wordOffset, wordOffset + length), which another process allocated, out of the selected engine's free
+//lists while the hole index still shows it free. The engine's free blocks tile the holes, so the hole around it
+//is taken whole and the words on either side handed back.
+void MemoryManager::takeFromEngine(int64_t length, int64_t wordOffset) {
+    if (mode != AllocatorMode::Tlsf && mode != AllocatorMode::Buddy)
+        return;
+    const map<int64_t, int64_t> &holes = bMap->getHoles();
+    auto hole = holes.upper_bound(wordOffset);
+    if (hole == holes.begin())
+        return;
+    --hole;
+    int64_t holeBegin = hole->first;
+    int64_t holeEnd = hole->first + hole->second;
+    if (mode == AllocatorMode::Tlsf)
+        tlsf->takeAt(holeEnd - holeBegin, holeBegin);
+    else
+        buddy->takeRange(holeEnd - holeBegin, holeBegin);
+    if (wordOffset > holeBegin)
+        returnToEngine(wordOffset - holeBegin, holeBegin);
+    if (holeEnd > wordOffset + length)
+        returnToEngine(holeEnd - (wordOffset + length), wordOffset + length);
+}
+
+//Allocates count blocks under one lock, writing each address (or nullptr) to out. Blocks are placed in order
+//exactly as count calls to allocate would be, bypassing the thread caches; returns how many succeeded.
+size_t MemoryManager::allocateBatch(const size_t *sizesInBytes, size_t count, void **out) {
+    auto guard = lockCore();
+    size_t placed = 0;
+    for (size_t i = 0; i < count; i++) {
+        int64_t output = allocateWords((int64_t) ((sizesInBytes[i] + wSize - 1) / wSize));
+        out[i] = output == -1 ? nullptr : output * wSize + memoryChunk;
+        if (trace)
+            trace->recordAllocate(sizesInBytes[i], output);
+        metrics->countAllocate(threadSlot(), output == -1);
+        if (output != -1)
+            placed++;
+    }
+    return placed;
+}
+
+//Frees count blocks under one lock. Released blocks are sorted and neighbours joined into runs first, so the
+//bitmap and hole index are updated once per run rather than once per block.
+void MemoryManager::freeBatch(void *const *addresses, size_t count) {
+    auto guard = lockCore();
+    if (readOnly)
+        return;
+    std::vector<std::pair<int64_t, int64_t>> released;
+    released.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        int64_t wordOffset = (int64_t) ((char *) addresses[i] - memoryChunk) / (int64_t) wSize;
+        if (trace)
+            trace->recordFree(wordOffset);
+        metrics->countFree(threadSlot());
+        if (threadSafe)
+            disownCached(wordOffset);
+        int64_t length = memTable->getSizeOffset(wordOffset);
+        if (length == -1)
+            continue;
+        memTable->deleteEntry(wordOffset);
+        released.push_back({wordOffset, length});
+        //engine free lists are order sensitive, so they see the blocks in the caller's order
+        returnToEngine(length, wordOffset);
+    }
+
+    std::sort(released.begin(), released.end());
+    size_t i = 0;
+    while (i < released.size()) {
+        int64_t begin = released[i].first;
+        int64_t end = begin + released[i].second;
+        while (++i < released.size() && released[i].first == end)
+            end += released[i].second;
+        bMap->release(end - begin, begin);
+        returnPages(end - begin, begin);
+    }
+    //as in releaseWords, start bits go once the words are free
+    for (auto &block : released)
+        markBlock(SharedChange::Free, block.first, block.second);
+}
+
 //Changes the allocation algorithm to identifying the memory hole to use for allocation.
 void MemoryManager::setAllocator(std::function<int(int, void *)> allocator) {
+    auto guard = lockCore();
+    flushCaches();
     alloc = allocator;
+    mode = AllocatorMode::Callback;
+}
+
+//Changes the allocation algorithm to one that reads the wide hole list, for arenas of any size.
+void MemoryManager::setWideAllocator(std::function<int64_t(int64_t, void *)> allocator) {
+    auto guard = lockCore();
+    flushCaches();
+    wideAlloc = allocator;
+    mode = AllocatorMode::WideCallback;
 }
 
+//Switches to a built-in allocation mode; BestFit and WorstFit pick the same hole as bestFit and worstFit.
+void MemoryManager::setAllocator(AllocatorMode allocatorMode) {
+    auto guard = lockCore();
+    flushCaches();
+    mode = allocatorMode;
+    rebuildEngine();
+}
+
+//Engines that keep their own free lists are only maintained while selected, so reload them from the hole index.
+void MemoryManager::rebuildEngine() {
+    if (mode == AllocatorMode::Tlsf) {
+        tlsf->clear();
+        for (auto &hole : bMap->getHoles())
+            tlsf->addFree(hole.second, hole.first);
+    } else if (mode == AllocatorMode::Buddy) {
+        buddy->clear();
+        for (auto &hole : bMap->getHoles())
+            buddy->addFree(hole.second, hole.first);
+    }
+}
+
+//Turns on locking and per-thread caches of small blocks so the manager can be shared between threads.
+//Call it before other threads start using the manager; turning it off returns every cached block.
+void MemoryManager::setThreadSafe(bool enabled) {
+    std::lock_guard<std::mutex> guard(coreLock);
+    if (enabled == threadSafe)
+        return;
+    if (enabled) {
+        caches = new ThreadCache[ThreadCache::SLOTS];
+        cacheOwners = new AllocTable;
+    } else {
+        flushCaches();
+        delete[] caches;
+        delete cacheOwners;
+        caches = nullptr;
+        cacheOwners = nullptr;
+    }
+    threadSafe = enabled;
+}
+
+//Sets how the next initialize backs an arena it allocates itself (see ArenaOptions); releaseBytes applies at once.
+void MemoryManager::setArenaOptions(const ArenaOptions &options) {
+    auto guard = lockCore();
+    arenaOptions = options;
+}
+
+//Returns what the current arena is backed by, e.g. Mapped where huge pages were asked for but not available.
+ArenaBacking MemoryManager::getArenaBacking() {
+    auto guard = lockCore();
+    return backing;
+}
+
+//Starts logging every allocate and free to filename (see Trace.h for the format), replacing any trace already
+//running; returns false if the file cannot be created. Like setThreadSafe, call it while no other thread is using
+//the manager. A trace started on a live arena begins with its size, but not the blocks already handed out.
+bool MemoryManager::startTrace(const char *filename) {
+    auto guard = lockCore();
+    delete trace;
+    trace = new TraceWriter;
+    if (!trace->open(filename)) {
+        delete trace;
+        trace = nullptr;
+        return false;
+    }
+    if (valid)
+        trace->recordInitialize(bMap->getRange(), (unsigned) wSize);
+    return true;
+}
+
+//Stops the trace and writes out what is still buffered; call it while no other thread is using the manager.
+void MemoryManager::stopTrace() {
+    auto guard = lockCore();
+    delete trace;
+    trace = nullptr;
+}
+
+//Returns the live block count, how the arena's words divide between blocks, holes and thread caches, and the
+//hole count and largest hole. Every figure is kept up to date as blocks come and go, so this is O(1).
+MemoryStats MemoryManager::getStats() {
+    auto guard = lockCore();
+    MemoryStats stats;
+    stats.cachedWords = cachedWords;
+    stats.liveAllocations = memTable->getCount() - cachedBlocks;
+    stats.freeWords = bMap->getFreeWords();
+    stats.usedWords = bMap->getRange() - stats.freeWords - stats.cachedWords;
+    stats.holes = bMap->holeCount();
+    stats.largestHole = bMap->largestHole();
+    return stats;
+}
+
+//Returns call counts, allocate/free latency histograms and the arena's fragmentation. The counters are read
+//without stopping other threads and the arena figures cost O(1); blocks parked in thread caches count as used.
+MetricsSnapshot MemoryManager::getMetrics() {
+    MetricsSnapshot snapshot;
+    metrics->collect(snapshot);
+    auto guard = lockCore();
+    snapshot.freeWords = bMap->getFreeWords();
+    snapshot.largestHole = bMap->largestHole();
+    snapshot.fragmentation = snapshot.freeWords ? 1.0 - (double) snapshot.largestHole / (double) snapshot.freeWords : 0;
+    return snapshot;
+}
+
+//Sets the call counters and histograms back to zero.
+void MemoryManager::resetMetrics() {
+    metrics->reset();
+}
+
+//Takes the core lock in thread-safe mode; returns an empty lock otherwise.
+MemoryManager::CoreGuard MemoryManager::lockCore() {
+    std::unique_lock<std::mutex> local = threadSafe ? std::unique_lock<std::mutex>(coreLock) : std::unique_lock<std::mutex>();
+    if (!sharedSync)
+        return CoreGuard(std::move(local), nullptr);
+    lockShared();
+    return CoreGuard(std::move(local), this);
+}
+
+//Serves a small block from this thread's cache, falling back to the core and recording the block as this slot's.
+void *MemoryManager::allocateCached(int64_t sizeInWords) {
+    int slot = threadSlot();
+    ThreadCache &cache = caches[slot];
+    {
+        std::lock_guard<std::mutex> slotGuard(cache.lock);
+        //a cached block of the next power of two also fits, which is what the buddy engine hands back
+        int64_t candidates[] = {sizeInWords, Buddy::roundUp(sizeInWords)};
+        for (int64_t length : candidates) {
+            if (length <= ThreadCache::SMALL_WORDS && !cache.bins[length].empty()) {
+                int64_t output = cache.bins[length].back();
+                cache.bins[length].pop_back();
+                cachedBlocks--;
+                cachedWords -= length;
+                cache.owned.addEntry(length, output);
+                return output * wSize + memoryChunk;
+            }
+        }
+    }
+
+    int64_t output, length;
+    {
+        auto guard = lockCore();
+        output = allocateWords(sizeInWords);
+        if (output == -1)
+            return nullptr;
+        length = memTable->getSizeOffset(output);
+        cacheOwners->addEntry(slot, output);
+    }
+    std::lock_guard<std::mutex> slotGuard(cache.lock);
+    cache.owned.addEntry(length, output);
+    return output * wSize + memoryChunk;
+}
+
+//Parks a block this thread's slot handed out in its cache; returns false if the block belongs elsewhere.
+bool MemoryManager::freeCached(int64_t wordOffset) {
+    ThreadCache &cache = caches[threadSlot()];
+    {
+        std::lock_guard<std::mutex> slotGuard(cache.lock);
+        int64_t length = cache.owned.getSizeOffset(wordOffset);
+        if (length == -1)
+            return false;
+        cache.owned.deleteEntry(wordOffset);
+        if (length <= ThreadCache::SMALL_WORDS && (int) cache.bins[length].size() < ThreadCache::BIN_DEPTH) {
+            cache.bins[length].push_back(wordOffset);
+            cachedBlocks++;
+            cachedWords += length;
+            return true;
+        }
+    }
+
+    //bin is full, so the block goes back to the core
+    auto guard = lockCore();
+    cacheOwners->deleteEntry(wordOffset);
+    releaseWords(wordOffset);
+    return true;
+}
+
+//drops a block handed out by another thread's slot from that slot's records; caller holds the core lock
+void MemoryManager::disownCached(int64_t wordOffset) {
+    int64_t slot = cacheOwners->getSizeOffset(wordOffset);
+    if (slot == -1)
+        return;
+    std::lock_guard<std::mutex> slotGuard(caches[slot].lock);
+    caches[slot].owned.deleteEntry(wordOffset);
+    cacheOwners->deleteEntry(wordOffset);
+}
+
+//returns every cached free block to the core so reports and engines see them as holes; caller holds the core lock
+void MemoryManager::flushCaches() {
+    if (!caches)
+        return;
+    for (int i = 0; i < ThreadCache::SLOTS; i++) {
+        std::lock_guard<std::mutex> slotGuard(caches[i].lock);
+        for (auto &bin : caches[i].bins) {
+            for (int64_t wordOffset : bin) {
+                cachedBlocks--;
+                cachedWords -= memTable->getSizeOffset(wordOffset);
+                cacheOwners->deleteEntry(wordOffset);
+                releaseWords(wordOffset);
+            }
+            bin.clear();
+        }
+    }
+}
+
+//writes every byte the parts describe, resuming after short writes and interrupted calls
+static bool writeParts(int fd, struct iovec *parts, int count) {
+    while (count > 0) {
+        ssize_t written = writev(fd, parts, count);
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        while (count > 0 && (size_t) written >= parts->iov_len) {
+            written -= (ssize_t) parts->iov_len;
+            parts++;
+            count--;
+        }
+        if (count > 0) {
+            parts->iov_base = (char *) parts->iov_base + written;
+            parts->iov_len -= (size_t) written;
+        }
+    }
+    return true;
+}
+
+//holes dumpMemoryMap copies per turn of the core lock
+static const size_t DUMP_BATCH_HOLES = 4096;
+
+//Fixed heap buffer the memory map is formatted into, written to fd whenever the next piece would not fit. After a
+//failed write nothing more is written and finish() reports the failure.
+class DumpWriter {
+public:
+    static const size_t BUFFER_BYTES = 64 * 1024;
+    //longest text hole: " - [", two 20-character int64_t values, ", " and "]"
+    static const size_t TEXT_HOLE_BYTES = 48;
+
+    explicit DumpWriter(int fd) : fd(fd), used(0), failed(false), buffer(BUFFER_BYTES) {}
+
+    //room for bytes more at the end of the buffer, flushing first if needed; nullptr once a write has failed
+    char *reserve(size_t bytes) {
+        if (used + bytes > BUFFER_BYTES && !flush())
+            return nullptr;
+        return failed ? nullptr : buffer.data() + used;
+    }
+
+    //keeps what was formatted into reserve()'s space, up to end
+    void commit(char *end) {
+        used = (size_t) (end - buffer.data());
+    }
+
+    void put(const void *data, size_t bytes) {
+        char *at = reserve(bytes);
+        if (at)
+            commit((char *) memcpy(at, data, bytes) + bytes);
+    }
+
+    bool finish() {
+        return flush();
+    }
+
+private:
+    bool flush() {
+        if (!failed && used) {
+            struct iovec part = {buffer.data(), used};
+            failed = !writeParts(fd, &part, 1);
+        }
+        used = 0;
+        return !failed;
+    }
+
+    int fd;
+    size_t used;
+    bool failed;
+    std::vector<char> buffer;
+};
+
 //Uses standard POSIX calls to write hole list to filename as text, returning -1 on error and 0 if successful.
 //Format: "[START, LENGTH] - [START, LENGTH] ...", e.g., "[0, 10] - [12, 2] - [20, 6]"
 int MemoryManager::dumpMemoryMap(char *filename) {
-    string outputMap = bMap->getMemmap();
-    char *buf = new char[outputMap.length()+1];
-    strcpy(buf, outputMap.c_str());
-    size_t bytes = strlen(buf);
+    return dumpMemoryMap(filename, DumpFormat::Text);
+}
+
+//As above, in the given format (see DumpFormat).
+int MemoryManager::dumpMemoryMap(char *filename, DumpFormat format) {
     remove(filename);
-    int myFile = open(filename, O_RDWR|O_CREAT|O_TRUNC, 777);
+    int myFile = open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0644);
     if(myFile == -1)
         return -1;
-    write(myFile, buf, bytes);
-    close(myFile);
-    delete[] buf;
+    int result = dumpMemoryMap(myFile, format);
+    if (close(myFile) != 0)
+        result = -1;
+    return result;
+}
+
+//Streams the hole list to fd, which stays open, through a DumpWriter::BUFFER_BYTES buffer flushed as it fills.
+//The holes are copied DUMP_BATCH_HOLES at a time under the core lock and written after it is released, so memory
+//and lock hold time stay bounded and a slow fd does not stall allocations. Each batch resumes after the last hole
+//written, so a dump taken while other threads allocate mixes holes from successive batches. The binary header's
+//count is taken with the first batch and rewritten at the end if the holes written differ; on an fd that cannot
+//seek that case returns -1. Returns -1 if a write fails, else 0.
+int MemoryManager::dumpMemoryMap(int fd, DumpFormat format) {
+    DumpWriter out(fd);
+    off_t headerAt = lseek(fd, 0, SEEK_CUR);
+    WideHoleListHeader header{};
+    memcpy(header.magic, WIDE_HOLE_LIST_MAGIC, sizeof header.magic);
+    header.version = WIDE_HOLE_LIST_VERSION;
+    header.fieldBits = 64;
+    std::vector<pair<int64_t, int64_t>> batch;
+    batch.reserve(DUMP_BATCH_HOLES);
+    uint64_t written = 0;
+    int64_t next = 0;
+    bool separate = false;
+    do {
+        batch.clear();
+        {
+            auto guard = lockCore();
+            if (written == 0) {
+                flushCaches();
+                header.holes = (uint64_t) bMap->holeCount();
+            }
+            const map<int64_t, int64_t> &holes = bMap->getHoles();
+            for (auto hole = holes.lower_bound(next); hole != holes.end() && batch.size() < DUMP_BATCH_HOLES; ++hole)
+                batch.push_back(*hole);
+        }
+        if (format == DumpFormat::Binary) {
+            if (written == 0)
+                out.put(&header, sizeof header);
+            for (auto &hole : batch) {
+                uint64_t fields[2] = {(uint64_t) hole.first, (uint64_t) hole.second};
+                out.put(fields, sizeof fields);
+            }
+        } else {
+            for (auto &hole : batch) {
+                char *at = out.reserve(DumpWriter::TEXT_HOLE_BYTES);
+                if (!at)
+                    break;
+                if (separate) {
+                    memcpy(at, " - ", 3);
+                    at += 3;
+                }
+                *at++ = '[';
+                at = to_chars(at, at + 20, hole.first).ptr;
+                *at++ = ',';
+                *at++ = ' ';
+                at = to_chars(at, at + 20, hole.second).ptr;
+                *at++ = ']';
+                out.commit(at);
+                separate = true;
+            }
+        }
+        written += batch.size();
+        if (!batch.empty())
+            next = batch.back().first + 1;
+    } while (batch.size() == DUMP_BATCH_HOLES);
+    if (!out.finish())
+        return -1;
+    if (format == DumpFormat::Binary && written != header.holes) {
+        header.holes = written;
+        if (headerAt == -1 || pwrite(fd, &header, sizeof header, headerAt) != (ssize_t) sizeof header)
+            return -1;
+    }
     return 0;
 }
 
+//Writes the arena's state to filename (see Snapshot.h) with one writev: the bitmap, a record for every live block
+//and, with withContents, the arena itself. Cached blocks are returned to the core first. Returns false if there
+//is no arena or the file cannot be written.
+bool MemoryManager::saveSnapshot(const char *filename, bool withContents) {
+    auto guard = lockCore();
+    if (!valid)
+        return false;
+    flushCaches();
+
+    SnapshotHeader header{};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof header.magic);
+    header.version = SNAPSHOT_VERSION;
+    header.byteOrder = SNAPSHOT_BYTE_ORDER;
+    header.wordSize = (uint32_t) wSize;
+    header.flags = withContents ? SNAPSHOT_CONTENTS : 0;
+    header.words = bMap->getRange();
+    header.records = memTable->getCount();
+    std::vector<AllocTable::Slot> records((size_t) header.records);
+    memTable->copyEntries(records.data());
+
+    struct iovec parts[4] = {
+            {&header, sizeof header},
+            {(void *) bMap->getBits(), (size_t) (header.words + 63) / 64 * sizeof(uint64_t)},
+            {records.data(), records.size() * sizeof(AllocTable::Slot)},
+            {memoryChunk, withContents ? memoryChunkCap : 0},
+    };
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        return false;
+    bool written = writeParts(fd, parts, 4);
+    return close(fd) == 0 && written;
+}
+
+//Replaces the current arena with the one saved in filename, allocating it as initialize(words) would. Returns
+//false, leaving the manager as it was, if the file is not a snapshot this manager's word size can load.
+bool MemoryManager::loadSnapshot(const char *filename) {
+    return loadSnapshot(filename, nullptr);
+}
+
+//Restores the snapshot in filename onto memory, as initialize(words, memory) would. A snapshot without contents
+//leaves memory as it is, so memory that outlived the process (a file or shared mapping) picks up where it was.
+//The bitmap and records are loaded directly and the holes derived from the bits, so restoring takes time in
+//proportion to the snapshot, however many allocations built it.
+bool MemoryManager::loadSnapshot(const char *filename, void *memory) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat status;
+    void *file = MAP_FAILED;
+    if (fstat(fd, &status) == 0 && (size_t) status.st_size >= sizeof(SnapshotHeader))
+        file = mmap(nullptr, (size_t) status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED)
+        return false;
+    bool loaded = restoreSnapshot((const char *) file, (size_t) status.st_size, memory);
+    munmap(file, (size_t) status.st_size);
+    return loaded;
+}
+
+//true if every word in [begin, end) is marked in use in bits
+static bool rangeInUse(const uint64_t *bits, int64_t begin, int64_t end) {
+    while (begin < end) {
+        int64_t stop = std::min(end, (begin | 63) + 1);
+        uint64_t mask = (stop - begin == 64 ? ~0ULL : (1ULL << (stop - begin)) - 1) << (begin & 63);
+        if ((bits[begin >> 6] & mask) != mask)
+            return false;
+        begin = stop;
+    }
+    return true;
+}
+
+//Checks a snapshot held in data and, if it is sound, makes it the arena. Records must lie inside the arena, cover
+//only words the bitmap marks in use and not overlap, so no free can release words of another block; they are
+//sorted by offset to check, O(records log records) on top of the snapshot's size.
+bool MemoryManager::restoreSnapshot(const char *data, size_t bytes, void *memory) {
+    SnapshotHeader header;
+    memcpy(&header, data, sizeof header);
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof header.magic) != 0 || header.version != SNAPSHOT_VERSION ||
+        header.byteOrder != SNAPSHOT_BYTE_ORDER || header.wordSize != wSize || header.words < 0 ||
+        header.words > MAX_WORDS || header.records < 0 || header.records > header.words)
+        return false;
+    size_t bitmapBytes = (size_t) (header.words + 63) / 64 * sizeof(uint64_t);
+    size_t recordBytes = (size_t) header.records * sizeof(AllocTable::Slot);
+    size_t contentsBytes = header.flags & SNAPSHOT_CONTENTS ? (size_t) header.words * wSize : 0;
+    if (bytes != sizeof header + bitmapBytes + recordBytes + contentsBytes)
+        return false;
+    //the header and bitmap are whole 64-bit words, so the records that follow are aligned
+    auto *bits = (const uint64_t *) (data + sizeof header);
+    auto *records = (const AllocTable::Slot *) (data + sizeof header + bitmapBytes);
+    std::vector<AllocTable::Slot> sorted;
+    try {
+        sorted.assign(records, records + header.records);
+    } catch (const std::bad_alloc &) {
+        return false;
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const AllocTable::Slot &a, const AllocTable::Slot &b) {
+        return a.offset < b.offset;
+    });
+    int64_t recordedTo = 0;
+    for (auto &record : sorted) {
+        if (record.offset < recordedTo || record.length <= 0 || record.length > header.words - record.offset ||
+            !rangeInUse(bits, record.offset, record.offset + record.length))
+            return false;
+        recordedTo = record.offset + record.length;
+    }
+
+    auto guard = lockCore();
+    if (valid)
+        clearArena();
+    try {
+        bMap->loadBits((size_t) header.words, bits);
+        memTable->reserve(header.records);
+        for (int64_t i = 0; i < header.records; i++)
+            memTable->addEntry(records[i].length, records[i].offset);
+        placeChunk((size_t) header.words * wSize, memory);
+        if (contentsBytes)
+            memcpy(memoryChunk, data + sizeof header + bitmapBytes + recordBytes, contentsBytes);
+        valid = true;
+        rebuildEngine();
+    } catch (const std::bad_alloc &) {
+        clearArena();
+        return false;
+    }
+    if (trace)
+        trace->recordInitialize(header.words, (unsigned) wSize);
+    return true;
+}
+
 //Returns a byte-stream of information (in decimal) about holes for use by the allocator function (little-Endian).
 //Offset and length are in words. If no memory has been allocated, the function should return a NULL pointer.
+//Arenas above LEGACY_MAX_WORDS do not fit this format and get NULL; use getListWide.
 void *MemoryManager::getList() {
-    return !bMap ? nullptr : bMap->ToList();
+    auto guard = lockCore();
+    flushCaches();
+    return !bMap || bMap->getRange() > LEGACY_MAX_WORDS ? nullptr : bMap->ToList();
+}
+
+//Returns the versioned hole list (WideHoleListHeader followed by the holes) for arenas of any size.
+//The buffer is a uint64_t array; release it with delete[].
+void *MemoryManager::getListWide() {
+    auto guard = lockCore();
+    flushCaches();
+    return bMap->ToListWide();
+}
+
+//Returns the manager's own hole list (same format as getList) without copying it. The view is read-only and
+//stays valid until the next allocate, free or shutdown; use getList for a copy to keep.
+const void *MemoryManager::getListView() {
+    auto guard = lockCore();
+    flushCaches();
+    return !bMap || bMap->getRange() > LEGACY_MAX_WORDS ? nullptr : bMap->viewList();
+}
+
+//Returns the manager's own wide hole list (same format as getListWide) without copying it, valid as getListView.
+const void *MemoryManager::getListWideView() {
+    auto guard = lockCore();
+    flushCaches();
+    return bMap->viewListWide();
 }
 
 //Returns a bit-stream of bits representing whether words are used (1) or free (0). The first two bytes are the
 //size of the bMap (little-Endian); the rest is the bMap, word-wise.
 void *MemoryManager::getBitmap() {
+    auto guard = lockCore();
+    flushCaches();
     return bMap->formatOutput();
 }
 
@@ -130,8 +1430,18 @@ void *MemoryManager::getMemoryStart() {
 
 }
 
+//Returns the word offset of address within the arena, the handle to pass to another process sharing it.
+int64_t MemoryManager::getWordOffset(void *address) {
+    return (int64_t) ((char *) address - memoryChunk) / (int64_t) wSize;
+}
+
+//Returns the address of the word at wordOffset in this process's mapping of the arena.
+void *MemoryManager::getAddress(int64_t wordOffset) {
+    return memoryChunk + wordOffset * wSize;
+}
+
 //Returns the byte limit of the current memory block.
-unsigned MemoryManager::getMemoryLimit() {
+size_t MemoryManager::getMemoryLimit() {
    // return bMap->getRange()*wSize;
     return memoryChunkCap;
 }
@@ -182,6 +1492,87 @@ int worstFit(int sizeInWords, void *list) {
     } else
         return -1;
 }
+//Returns word offset of the first hole in the list that fits, and -1 if there is no fit.
+int firstFit(int sizeInWords, void *list) {
+    auto *hList = (uint16_t *) list;
+    uint16_t hListrange = *hList++;
+
+    if (sizeInWords > 0) {
+        int i = 1;
+        while (i < hListrange * 2) {
+            if (hList[i] >= sizeInWords)
+                return hList[i - 1];
+            i += 2;
+        }
+    }
+    return -1;
+}
+
+//Returns word offset of hole selected by best fit from a wide hole list, and -1 if there is no fit.
+int64_t bestFitWide(int64_t sizeInWords, void *list) {
+    auto *header = (WideHoleListHeader *) list;
+    if (sizeInWords <= 0 || memcmp(header->magic, WIDE_HOLE_LIST_MAGIC, sizeof(header->magic)) != 0)
+        return -1;
+
+    int64_t minEmpty = INT64_MAX;
+    int64_t minIndex = -1;
+    for (uint64_t i = 0; i < header->holes; i++) {
+        int64_t offset, length;
+        wideHole(header, i, offset, length);
+        if (length >= sizeInWords && length < minEmpty) {
+            minEmpty = length;
+            minIndex = offset;
+        }
+    }
+    return minIndex;
+}
+
+//Returns word offset of hole selected by worst fit from a wide hole list, and -1 if there is no fit.
+int64_t worstFitWide(int64_t sizeInWords, void *list) {
+    auto *header = (WideHoleListHeader *) list;
+    if (sizeInWords <= 0 || memcmp(header->magic, WIDE_HOLE_LIST_MAGIC, sizeof(header->magic)) != 0)
+        return -1;
+
+    int64_t maxEmpty = 0;
+    int64_t maxIndex = -1;
+    for (uint64_t i = 0; i < header->holes; i++) {
+        int64_t offset, length;
+        wideHole(header, i, offset, length);
+        if (length >= sizeInWords && length > maxEmpty) {
+            maxEmpty = length;
+            maxIndex = offset;
+        }
+    }
+    return maxIndex;
+}
+
+//Returns word offset of the first hole in a wide hole list that fits, and -1 if there is no fit.
+int64_t firstFitWide(int64_t sizeInWords, void *list) {
+    auto *header = (WideHoleListHeader *) list;
+    if (sizeInWords <= 0 || memcmp(header->magic, WIDE_HOLE_LIST_MAGIC, sizeof(header->magic)) != 0)
+        return -1;
+
+    for (uint64_t i = 0; i < header->holes; i++) {
+        int64_t offset, length;
+        wideHole(header, i, offset, length);
+        if (length >= sizeInWords)
+            return offset;
+    }
+    return -1;
+}
+
+//Reads hole i of a wide hole list in either field width.
+void wideHole(const WideHoleListHeader *header, uint64_t i, int64_t &offset, int64_t &length) {
+    if (header->fieldBits == 32) {
+        auto *fields = (const uint32_t *) (header + 1);
+        offset = fields[2 * i];
+        length = fields[2 * i + 1];
+    } else {
+        auto *fields = (const uint64_t *) (header + 1);
+        offset = (int64_t) fields[2 * i];
+        length = (int64_t) fields[2 * i + 1];
+    }
+}
 /*
 
 int main() {
@@ -13,43 +13,210 @@
 #include <vector>
 #include <cmath>
 #include <string.h>
-#include "LinkedList.h"
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <new>
+#include "AllocTable.h"
 #include "MyBitMap.h"
+#include "Tlsf.h"
+#include "Buddy.h"
+#include "ThreadCache.h"
+#include "Trace.h"
+#include "Metrics.h"
+#include "Snapshot.h"
+#include "ArenaFile.h"
 
 using namespace std;
 
+//Built-in allocation modes; Callback hands the hole list to the allocator function, WideCallback the wide one.
+//FirstFit takes the lowest hole that fits, NextFit the first one at or after where the previous block ended.
+enum class AllocatorMode { Callback, BestFit, WorstFit, Tlsf, Buddy, WideCallback, FirstFit, NextFit };
+
+//Largest arena the 16-bit hole list and allocator functions serve (a free 65536-word arena is listed as two holes),
+//and the largest arena overall
+const int64_t LEGACY_MAX_WORDS = 65536;
+const int64_t MAX_WORDS = (int64_t) 1 << 48;
+
+//Arena summary returned by getStats; usedWords + freeWords + cachedWords is the arena size. cachedWords are free
+//blocks parked in thread caches (thread-safe mode), which only same-size requests can reuse.
+struct MemoryStats {
+    int64_t liveAllocations;
+    int64_t usedWords;
+    int64_t freeWords;
+    int64_t cachedWords;
+    int64_t holes;
+    int64_t largestHole;
+};
+
+//How initialize backs an arena it allocates itself; arenas passed in by the caller are used as given. mapped takes
+//the arena from anonymous mmap instead of new char[]: hugePages asks for MAP_HUGETLB pages, or a transparent huge
+//page hint when none are reserved, and lazyCommit maps with MAP_NORESERVE so untouched pages cost nothing. Freed
+//blocks of at least releaseBytes hand their whole pages back with MADV_DONTNEED (0 keeps them). Whatever the
+//system refuses falls back to the next option down, and finally to new char[].
+struct ArenaOptions {
+    bool mapped;
+    bool hugePages;
+    bool lazyCommit;
+    size_t releaseBytes;
+};
+
+//Formats for dumpMemoryMap: Text is "[START, LENGTH] - ..." and Binary a WideHoleListHeader with 64-bit fields
+//followed by the (offset, length) pairs, as getListWide lays them out
+enum class DumpFormat { Text, Binary };
+
+//What the current arena ended up in, as reported by getArenaBacking
+enum class ArenaBacking { None, External, Heap, Mapped, HugePages, File };
+
 class MemoryManager {
 
 private:
 
     size_t wSize;
     std::function<int(int, void *)> alloc;
+    std::function<int64_t(int64_t, void *)> wideAlloc;
+    AllocatorMode mode;
     char* memoryChunk;
-    int memoryChunkCap;
+    size_t memoryChunkCap;
+    bool ownsChunk;
     bool valid;
+    //mapped arenas: the length given to mmap and the page size pages are released in
+    ArenaOptions arenaOptions;
+    ArenaBacking backing;
+    size_t mappedBytes;
+    size_t pageBytes;
+    //file-backed arenas: the whole shared mapping, the descriptor holding the writer's lock and the block start
+    //bits inside the mapping; readOnly views refuse allocate and free
+    char *fileMapping;
+    size_t fileBytes;
+    int arenaFile;
+    uint64_t *blockStarts;
+    bool readOnly;
+    //shared arenas: the lock and change count in the segment, the count this process's view matches and whether
+    //this process holds the lock
+    SharedArenaSync *sharedSync;
+    uint64_t seenGeneration;
+    bool sharedLocked;
     MyBitMap *bMap;
-    LinkedList *memLinkedlist;
+    AllocTable *memTable;
+    Tlsf *tlsf;
+    Buddy *buddy;
+    //where NextFit resumes searching: the word after the last block it placed
+    int64_t nextFitCursor;
+
+    //thread-safe mode: coreLock guards everything above, caches front small blocks per thread
+    bool threadSafe;
+    std::mutex coreLock;
+    ThreadCache *caches;
+    AllocTable *cacheOwners;
+    std::atomic<int64_t> cachedBlocks;
+    std::atomic<int64_t> cachedWords;
+
+    //held while the core is in use: coreLock in thread-safe mode and, for a shared arena, the segment's lock
+    class CoreGuard {
+    public:
+        CoreGuard(std::unique_lock<std::mutex> local, MemoryManager *shared)
+                : local(std::move(local)), shared(shared) {}
+        CoreGuard(CoreGuard &&other) noexcept : local(std::move(other.local)), shared(other.shared) {
+            other.shared = nullptr;
+        }
+        ~CoreGuard() {
+            if (shared)
+                shared->unlockShared();
+        }
+
+    private:
+        std::unique_lock<std::mutex> local;
+        MemoryManager *shared;
+    };
+
+    //set while a trace is being recorded
+    TraceWriter *trace;
+    Metrics *metrics;
+
+    int64_t findHole(int64_t sizeInWords);
+    void *placeBlock(size_t sizeInBytes);
+    void releaseBlock(int64_t wordOffset);
+    int64_t allocateWords(int64_t sizeInWords);
+    void releaseWords(int64_t wordOffset);
+    bool resizeWords(int64_t wordOffset, int64_t sizeInWords, int64_t &length);
+    void returnToEngine(int64_t length, int64_t wordOffset);
+    void takeFromEngine(int64_t length, int64_t wordOffset);
+    void rebuildEngine();
+    void placeChunk(size_t bytes, void *memory);
+    char *acquireChunk(size_t bytes);
+    void releaseChunk();
+    void returnPages(int64_t length, int64_t wordOffset);
+    void clearArena();
+    bool mapArenaFile(int fd, size_t sizeInWords, bool readOnlyView, bool shared);
+    void attachMapping(bool readOnlyView);
+    void lockShared();
+    void unlockShared();
+    void syncShared();
+    void replayChange(const SharedArenaChange &entry);
+    void logChange(SharedChange change, int64_t wordOffset, int64_t length);
+    void loadBlockStarts();
+    void markBlock(SharedChange change, int64_t wordOffset, int64_t length);
+    bool restoreSnapshot(const char *data, size_t bytes, void *memory);
+    CoreGuard lockCore();
+    void *allocateCached(int64_t sizeInWords);
+    bool freeCached(int64_t wordOffset);
+    void disownCached(int64_t wordOffset);
+    void flushCaches();
 
 public:
 
     MemoryManager(unsigned wordSize, std::function<int(int, void *)> allocator);
+    MemoryManager(unsigned wordSize, AllocatorMode allocatorMode);
     ~MemoryManager();
-    void initialize(size_t sizeInWords);
+    bool initialize(size_t sizeInWords);
+    bool initialize(size_t sizeInWords, void *memory);
+    bool initialize(const char *filename, size_t sizeInWords, bool readOnlyView);
+    bool initializeShared(const char *name, size_t sizeInWords);
+    static bool unlinkShared(const char *name);
     void shutdown();
     void *allocate(size_t sizeInBytes);
     void free(void *address);
+    void *reallocate(void *address, size_t newSizeInBytes);
+    size_t allocateBatch(const size_t *sizesInBytes, size_t count, void **out);
+    void freeBatch(void *const *addresses, size_t count);
     void setAllocator(std::function<int(int, void *)> allocator);
+    void setAllocator(AllocatorMode allocatorMode);
+    void setWideAllocator(std::function<int64_t(int64_t, void *)> allocator);
+    void setThreadSafe(bool enabled);
+    void setArenaOptions(const ArenaOptions &options);
+    ArenaBacking getArenaBacking();
+    bool startTrace(const char *filename);
+    void stopTrace();
+    MemoryStats getStats();
+    MetricsSnapshot getMetrics();
+    void resetMetrics();
     int dumpMemoryMap(char *filename);
+    int dumpMemoryMap(char *filename, DumpFormat format);
+    int dumpMemoryMap(int fd, DumpFormat format);
+    bool saveSnapshot(const char *filename, bool withContents);
+    bool loadSnapshot(const char *filename);
+    bool loadSnapshot(const char *filename, void *memory);
     void *getList();
+    void *getListWide();
+    const void *getListView();
+    const void *getListWideView();
     void *getBitmap();
     unsigned getWordSize();
     void *getMemoryStart();
-    unsigned getMemoryLimit();
+    int64_t getWordOffset(void *address);
+    void *getAddress(int64_t wordOffset);
+    size_t getMemoryLimit();
 
 };
 
 //Algorithms
 int bestFit(int sizeInWords, void *list);
 int worstFit(int sizeInWords, void *list);
+int firstFit(int sizeInWords, void *list);
+int64_t bestFitWide(int64_t sizeInWords, void *list);
+int64_t worstFitWide(int64_t sizeInWords, void *list);
+int64_t firstFitWide(int64_t sizeInWords, void *list);
+void wideHole(const WideHoleListHeader *header, uint64_t i, int64_t &offset, int64_t &length);
 
 #endif //OFFICIALMEMORYMANAGER_MEMORYMANAGER_H
@@ -0,0 +1,85 @@
+#include "Metrics.h"
+
+//number of calls in the histogram
+uint64_t LatencyHistogram::total() const {
+    uint64_t calls = 0;
+    for (uint64_t count : counts)
+        calls += count;
+    return calls;
+}
+
+//returns the upper bound in nanoseconds of the bucket holding the given fraction of calls, 0 if there are none
+uint64_t LatencyHistogram::percentile(double fraction) const {
+    uint64_t calls = total();
+    if (calls == 0)
+        return 0;
+    uint64_t rank = (uint64_t) (fraction * (double) (calls - 1));
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += counts[i];
+        if (seen > rank)
+            return (2ULL << i) - 1;
+    }
+    return (2ULL << (BUCKETS - 1)) - 1;
+}
+
+//Constructor; all counters start at zero
+Metrics::Metrics() {
+    reset();
+}
+
+void Metrics::recordAllocate(int shard, uint64_t nanos, bool failed) {
+    shards[shard].allocateBuckets[bucket(nanos)].fetch_add(1, std::memory_order_relaxed);
+    countAllocate(shard, failed);
+}
+
+void Metrics::recordFree(int shard, uint64_t nanos) {
+    shards[shard].freeBuckets[bucket(nanos)].fetch_add(1, std::memory_order_relaxed);
+    countFree(shard);
+}
+
+//counts an allocation without a latency, as batch calls do
+void Metrics::countAllocate(int shard, bool failed) {
+    shards[shard].allocations.fetch_add(1, std::memory_order_relaxed);
+    if (failed)
+        shards[shard].failedAllocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+//counts a free without a latency, as batch calls do
+void Metrics::countFree(int shard) {
+    shards[shard].frees.fetch_add(1, std::memory_order_relaxed);
+}
+
+//sums every shard into snapshot; the arena fields are left to the caller
+void Metrics::collect(MetricsSnapshot &snapshot) {
+    snapshot = MetricsSnapshot{};
+    for (auto &shard : shards) {
+        for (int i = 0; i < LatencyHistogram::BUCKETS; i++) {
+            snapshot.allocateLatency.counts[i] += shard.allocateBuckets[i].load(std::memory_order_relaxed);
+            snapshot.freeLatency.counts[i] += shard.freeBuckets[i].load(std::memory_order_relaxed);
+        }
+        snapshot.allocations += shard.allocations.load(std::memory_order_relaxed);
+        snapshot.failedAllocations += shard.failedAllocations.load(std::memory_order_relaxed);
+        snapshot.frees += shard.frees.load(std::memory_order_relaxed);
+    }
+}
+
+void Metrics::reset() {
+    for (auto &shard : shards) {
+        for (int i = 0; i < LatencyHistogram::BUCKETS; i++) {
+            shard.allocateBuckets[i].store(0, std::memory_order_relaxed);
+            shard.freeBuckets[i].store(0, std::memory_order_relaxed);
+        }
+        shard.allocations.store(0, std::memory_order_relaxed);
+        shard.failedAllocations.store(0, std::memory_order_relaxed);
+        shard.frees.store(0, std::memory_order_relaxed);
+    }
+}
+
+//index of the highest set bit, clamped to the last bucket
+int Metrics::bucket(uint64_t nanos) {
+    if (nanos == 0)
+        return 0;
+    int highest = 63 - __builtin_clzll(nanos);
+    return highest < LatencyHistogram::BUCKETS ? highest : LatencyHistogram::BUCKETS - 1;
+}
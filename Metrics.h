@@ -0,0 +1,62 @@
+#ifndef OFFICIALMEMORYMANAGER_METRICS_H
+#define OFFICIALMEMORYMANAGER_METRICS_H
+
+#include <cstdint>
+#include <atomic>
+
+//Log-bucketed call latencies: bucket i counts calls that took [2^i, 2^(i+1)) nanoseconds, bucket 0 also takes 0.
+struct LatencyHistogram {
+    static const int BUCKETS = 40;
+
+    uint64_t counts[BUCKETS];
+
+    uint64_t total() const;
+    uint64_t percentile(double fraction) const;
+};
+
+//Point-in-time copy of a manager's metrics.
+struct MetricsSnapshot {
+    LatencyHistogram allocateLatency;
+    LatencyHistogram freeLatency;
+    uint64_t allocations;
+    uint64_t failedAllocations;
+    uint64_t frees;
+    //external fragmentation: 1 - largestHole / freeWords, 0 when nothing is free
+    int64_t freeWords;
+    int64_t largestHole;
+    double fragmentation;
+};
+
+//Call counters and latency histograms, updated with relaxed atomics. Counters are spread over shards so threads
+//on different shards never write the same cache line; a snapshot sums them. Every call is counted, but only one
+//in SAMPLE_EVERY per thread is timed, which keeps clock reads off most calls.
+class Metrics {
+public:
+    static const int SHARDS = 16;
+    static const unsigned SAMPLE_EVERY = 16;
+
+public:
+    Metrics();
+    void recordAllocate(int shard, uint64_t nanos, bool failed);
+    void recordFree(int shard, uint64_t nanos);
+    void countAllocate(int shard, bool failed);
+    void countFree(int shard);
+    void collect(MetricsSnapshot &snapshot);
+    void reset();
+
+private:
+    static int bucket(uint64_t nanos);
+
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> allocateBuckets[LatencyHistogram::BUCKETS];
+        std::atomic<uint64_t> freeBuckets[LatencyHistogram::BUCKETS];
+        std::atomic<uint64_t> allocations;
+        std::atomic<uint64_t> failedAllocations;
+        std::atomic<uint64_t> frees;
+    };
+
+    Shard shards[SHARDS];
+};
+
+
+#endif //OFFICIALMEMORYMANAGER_METRICS_H
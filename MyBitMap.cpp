@@ -2,42 +2,116 @@
 // Created by Kemari Chen Loy on 3/20/22.
 //
 
+#include <cstring>
 #include "MyBitMap.h"
 
+//Constructor; no buffer until setMyBitmap is called
+MyBitMap::MyBitMap() {
+    memBuf = nullptr;
+    ownsBuf = false;
+    memR = 0;
+    memW = 0;
+    freeWords = 0;
+    listStale = true;
+    wideStale = true;
+}
+
+//Destructor; releases the buffer if one is still held
+MyBitMap::~MyBitMap() {
+    clear();
+}
+
 //deleted the occupied memory in area of use by the buffer
 void MyBitMap::clear() {
-    if (memBuf)
+    if (memBuf && ownsBuf)
     {
         delete[] memBuf;
     }
+    memBuf = nullptr;
+    ownsBuf = false;
+    memR = 0;
+    memW = 0;
+    holes.clear();
+    holesBySize.clear();
+    freeWords = 0;
+    blockPrefix.clear();
+    blockSuffix.clear();
+    blockLongest.clear();
+    groupTree.clear();
+    groupLeaves = 0;
+    staleGroups.clear();
+    groupStale.clear();
+    listStale = true;
+    wideStale = true;
 }
 
-void MyBitMap::setMyBitmap(unsigned n){
-    memBuf = new int[n];
-    unsigned i = 0;
-    while(i < n){
+//packs n words into 64-bit entries, all marked free
+void MyBitMap::setMyBitmap(size_t n){
+    memW = (int64_t) ((n + 63) / 64);
+    memBuf = new uint64_t[memW];
+    ownsBuf = true;
+    int64_t i = 0;
+    while(i < memW){
         memBuf[i] = 0x00;
         i++;
     }
     memR = n;
+    holes.clear();
+    holesBySize.clear();
+    freeWords = 0;
+    if (memR > 0)
+        addHole(0, memR);
+    buildSummary();
+    listStale = true;
+    wideStale = true;
+}
+
+//sizes the map for n words like setMyBitmap, but takes their bits from bits ((n + 63) / 64 entries) and derives
+//the holes from them
+void MyBitMap::loadBits(size_t n, const uint64_t *bits) {
+    memW = (int64_t) ((n + 63) / 64);
+    memBuf = new uint64_t[memW];
+    ownsBuf = true;
+    memcpy(memBuf, bits, (size_t) memW * sizeof(uint64_t));
+    memR = n;
+    //bits past the last word stay clear, as setMyBitmap leaves them
+    if (memR & 63)
+        memBuf[memW - 1] &= ~(~0ULL << (memR & 63));
+    rebuildHoles();
 }
 
-//Boolen to check if the memory in buffer is correctly allocated and then sets it
-bool MyBitMap::set(int n)
+//Like loadBits, but keeps the bits where they are (e.g. in a file mapping) and updates them in place; the caller
+//keeps bits alive until clear(). Bits past the last word must already be clear. A map attached to read-only
+//memory must not be changed.
+void MyBitMap::attachBits(size_t n, uint64_t *bits) {
+    memW = (int64_t) ((n + 63) / 64);
+    memBuf = bits;
+    ownsBuf = false;
+    memR = n;
+    rebuildHoles();
+}
+
+//the packed bits, getRange() of them in (getRange() + 63) / 64 entries
+const uint64_t *MyBitMap::getBits() {
+    return memBuf;
+}
+
+//Boolen to check if the memory in buffer is correctly allocated and then sets it; the hole index follows
+bool MyBitMap::set(int64_t n)
 {
     if (n >= 0 && n < memR) {
-        memBuf[n] = 1;
+        setRange(1, n, true);
         return true;
     } else {
         return false;
     }
 }
 
-//Boolen to check if the memory in buffer is correctly allocated and then unsets it
-bool MyBitMap::unset(int n)
+//Boolen to check if the memory in buffer is correctly allocated and then unsets it; the hole index follows
+bool MyBitMap::unset(int64_t n)
 {
     if (n >= 0 && n < memR) {
-        memBuf[n] = 0;
+        setRange(1, n, false);
         return true;
     } else {
         return false;
@@ -45,130 +119,436 @@ bool MyBitMap::unset(int n)
 }
 
 //determines if memory is in use and then returns that value
-int MyBitMap::get(int n)
+int MyBitMap::get(int64_t n)
 {
     if (n >= 0 && n < memR)
-        return memBuf[n];
+        return (int) ((memBuf[n >> 6] >> (n & 63)) & 1);
     return false;
 }
 
 //returns the range of size of memory block currently allocated
-int MyBitMap::getRange() {
+int64_t MyBitMap::getRange() {
     return memR;
 }
 
 //keeps track of holes
-void MyBitMap::append(int length, int offset) {
-    int check = offset + length;
-    int i = offset;
-    while(i < check){
-        set(i);
-        i++;
-    }
+void MyBitMap::append(int64_t length, int64_t offset) {
+    setRange(length, offset, true);
 }
 
 //Memory that is in used is freed here
-void MyBitMap::release(int length, int offset) {
-    int check = offset + length;
-    int i = offset;
-    while(i < check){
-        unset(i);
-        i++;
+void MyBitMap::release(int64_t length, int64_t offset) {
+    setRange(length, offset, false);
+}
+
+//sets or clears [offset, offset + length) a whole entry at a time; words outside the map are ignored
+void MyBitMap::setRange(int64_t length, int64_t offset, bool used) {
+    int64_t begin = offset < 0 ? 0 : offset;
+    int64_t end = offset + length > memR ? memR : offset + length;
+    if (begin >= end)
+        return;
+
+    if (used)
+        carveHole(begin, end);
+    else
+        mergeHole(begin, end);
+    listStale = true;
+    wideStale = true;
+
+    int64_t first = begin >> 6;
+    int64_t last = (end - 1) >> 6;
+    uint64_t headMask = ~0ULL << (begin & 63);
+    uint64_t tailMask = ~0ULL >> (63 - ((end - 1) & 63));
+
+    if (first == last) {
+        uint64_t mask = headMask & tailMask;
+        memBuf[first] = used ? memBuf[first] | mask : memBuf[first] & ~mask;
+    } else {
+        memBuf[first] = used ? memBuf[first] | headMask : memBuf[first] & ~headMask;
+        for (int64_t w = first + 1; w < last; w++)
+            memBuf[w] = used ? ~0ULL : 0;
+        memBuf[last] = used ? memBuf[last] | tailMask : memBuf[last] & ~tailMask;
     }
+
+    for (int64_t block = first; block <= last; block++)
+        summarizeBlock(block);
 }
 
-//return the correct output of the string text
-string MyBitMap::getMemmap() {
-    string output;
-    int begin = 0;
-    int range;
-    int i = 0;
-    while (begin + i < memR) {
-        if (get(begin) != 0)
-            begin++;
-        else {
-            i = 0;
-            range = 0;
-            while (!get(begin + i) && (begin + i < memR)) {
-                range++;
-                i++;
-            }
-            output += (string) "[" + to_string(begin) + ", " + to_string(range) + "] - ";
-            begin += i;
-            i = 0;
+//removes [begin, end) from the hole index, splitting any hole that straddles it
+void MyBitMap::carveHole(int64_t begin, int64_t end) {
+    auto it = holes.upper_bound(begin);
+    if (it != holes.begin()) {
+        auto prev = std::prev(it);
+        if (prev->first + prev->second > begin)
+            it = prev;
+    }
+    while (it != holes.end() && it->first < end) {
+        int64_t holeBegin = it->first;
+        int64_t holeEnd = it->first + it->second;
+        it = dropHole(it);
+        if (holeBegin < begin)
+            addHole(holeBegin, begin - holeBegin);
+        if (holeEnd > end) {
+            addHole(end, holeEnd - end);
+            break;
+        }
+    }
+}
+
+//adds [begin, end) to the hole index, coalescing with any hole it touches
+void MyBitMap::mergeHole(int64_t begin, int64_t end) {
+    auto it = holes.upper_bound(begin);
+    if (it != holes.begin()) {
+        auto prev = std::prev(it);
+        if (prev->first + prev->second >= begin) {
+            begin = prev->first;
+            end = max(end, prev->first + prev->second);
+            dropHole(prev);
         }
     }
-    //extra strings erased
-   // char temp = output.size()-3;
+    while (it != holes.end() && it->first <= end) {
+        end = max(end, it->first + it->second);
+        it = dropHole(it);
+    }
+    addHole(begin, end - begin);
+}
 
-    return output.substr(0, output.size()-3);
+//records a hole in both indexes
+void MyBitMap::addHole(int64_t begin, int64_t length) {
+    holes[begin] = length;
+    holesBySize.insert({length, begin});
+    freeWords += length;
 }
 
-//create an array of holes
-uint16_t *MyBitMap::ToList() {
-    int holes = 0;
-    int begin = 0;
-    while (begin < memR) {
-        if (get(begin) != 0)
-            begin++;
-        else {
-            holes++;
-            while (!get(begin) && begin < memR)
-                begin++;
+//forgets a hole in both indexes, returning the next hole by offset
+map<int64_t, int64_t>::iterator MyBitMap::dropHole(map<int64_t, int64_t>::iterator hole) {
+    holesBySize.erase({hole->second, hole->first});
+    freeWords -= hole->second;
+    return holes.erase(hole);
+}
+
+//returns the offset of the smallest hole of at least n words (lowest offset on ties), -1 if none
+int64_t MyBitMap::bestHole(int64_t n) {
+    if (n <= 0)
+        return -1;
+    auto it = holesBySize.lower_bound({n, INT64_MIN});
+    return it == holesBySize.end() ? -1 : it->second;
+}
+
+//returns the offset of the largest hole if it holds n words (lowest offset on ties), -1 if not
+int64_t MyBitMap::worstHole(int64_t n) {
+    if (n <= 0 || holesBySize.empty() || holesBySize.rbegin()->first < n)
+        return -1;
+    return holesBySize.lower_bound({holesBySize.rbegin()->first, INT64_MIN})->second;
+}
+
+//returns the start of the lowest run of n free words, -1 if there is none
+int64_t MyBitMap::findFirstFit(int64_t n) {
+    return findFit(n, 0);
+}
+
+//returns the start of the first run of n free words at or after start, wrapping round to the lowest one if
+//nothing fits past start; -1 if there is none
+int64_t MyBitMap::findNextFit(int64_t n, int64_t start) {
+    int64_t output = findFit(n, start < 0 ? 0 : start);
+    return output == -1 && start > 0 ? findFit(n, 0) : output;
+}
+
+//the bits of one summary block; words past the end of the map read as used
+uint64_t MyBitMap::blockBits(int64_t block) {
+    uint64_t bits = memBuf[block];
+    if (block == memW - 1 && (memR & 63))
+        bits |= ~0ULL << (memR & 63);
+    return bits;
+}
+
+//recomputes one block's hints and marks its group for the next search
+void MyBitMap::summarizeBlock(int64_t block) {
+    uint64_t bits = blockBits(block);
+    blockPrefix[block] = (uint8_t) (bits ? __builtin_ctzll(bits) : 64);
+    blockSuffix[block] = (uint8_t) (bits ? __builtin_clzll(bits) : 64);
+    //each round drops the last free word of every run, so the rounds it takes is the longest run
+    uint64_t free = ~bits;
+    int longest = bits ? 0 : 64;
+    while (bits && free) {
+        free &= free >> 1;
+        longest++;
+    }
+    blockLongest[block] = (uint8_t) longest;
+
+    int64_t group = block / GROUP_BLOCKS;
+    if (!groupStale[group]) {
+        groupStale[group] = true;
+        staleGroups.push_back(group);
+    }
+}
+
+//rebuilds a group's tree leaf from its block hints and updates the nodes above it
+void MyBitMap::summarizeGroup(int64_t group) {
+    RunSummary leaf = {0, 0, 0, GROUP_BLOCKS * BLOCK_WORDS};
+    int64_t firstBlock = group * GROUP_BLOCKS;
+    int64_t lastBlock = min(firstBlock + GROUP_BLOCKS, memW);
+    bool allFree = true;
+    int64_t run = 0;
+    for (int64_t block = firstBlock; block < lastBlock; block++) {
+        if (allFree)
+            leaf.prefix += blockPrefix[block];
+        leaf.longest = max(leaf.longest, max((int64_t) blockLongest[block], run + blockPrefix[block]));
+        if (blockPrefix[block] == BLOCK_WORDS) {
+            run += BLOCK_WORDS;
+        } else {
+            allFree = false;
+            run = blockSuffix[block];
+        }
+    }
+    //blocks past the end of the map count as used
+    leaf.suffix = lastBlock == firstBlock + GROUP_BLOCKS ? run : 0;
+
+    int64_t node = groupLeaves + group;
+    groupTree[node] = leaf;
+    for (node /= 2; node >= 1; node /= 2) {
+        const RunSummary &a = groupTree[2 * node];
+        const RunSummary &b = groupTree[2 * node + 1];
+        RunSummary &joined = groupTree[node];
+        joined.length = a.length + b.length;
+        joined.prefix = a.prefix == a.length ? a.length + b.prefix : a.prefix;
+        joined.suffix = b.suffix == b.length ? b.length + a.suffix : b.suffix;
+        joined.longest = max(max(a.longest, b.longest), a.suffix + b.prefix);
+    }
+}
+
+//sizes the summary for the current map and summarizes every block
+void MyBitMap::buildSummary() {
+    int64_t groups = (memW + GROUP_BLOCKS - 1) / GROUP_BLOCKS;
+    groupLeaves = 1;
+    while (groupLeaves < groups)
+        groupLeaves *= 2;
+    blockPrefix.assign(memW, 0);
+    blockSuffix.assign(memW, 0);
+    blockLongest.assign(memW, 0);
+    //leaves past the last group are empty spans
+    groupTree.assign(2 * groupLeaves, RunSummary{0, 0, 0, 0});
+    groupStale.assign(groups, false);
+    staleGroups.clear();
+    for (int64_t block = 0; block < memW; block++)
+        summarizeBlock(block);
+    refreshSummary();
+}
+
+//brings the tree up to date with the groups whose blocks changed since the last search
+void MyBitMap::refreshSummary() {
+    for (int64_t group : staleGroups) {
+        summarizeGroup(group);
+        groupStale[group] = false;
+    }
+    staleGroups.clear();
+}
+
+//Returns the lowest p >= start with [p, p + n) free, -1 if there is none. The search walks the tree left to
+//right carrying the free run that reaches the current position, and only descends where a fit can start.
+int64_t MyBitMap::findFit(int64_t n, int64_t start) {
+    if (n <= 0 || n > memR || start >= memR || n > freeWords)
+        return -1;
+    refreshSummary();
+    int64_t carry = 0;
+    return searchNode(1, 0, groupLeaves, n, start, carry);
+}
+
+//searches tree node covering groups [lo, hi); carry is the free run reaching the node's first word
+int64_t MyBitMap::searchNode(int64_t node, int64_t lo, int64_t hi, int64_t n, int64_t start, int64_t &carry) {
+    int64_t begin = lo * GROUP_BLOCKS * BLOCK_WORDS;
+    if (hi * GROUP_BLOCKS * BLOCK_WORDS <= start)
+        return -1;
+    const RunSummary &summary = groupTree[node];
+    if (begin >= start) {
+        if (carry + summary.prefix >= n)
+            return begin - carry;
+        if (summary.longest < n) {
+            carry = summary.prefix == summary.length ? carry + summary.length : summary.suffix;
+            return -1;
         }
     }
-    auto * myArray = new uint16_t[2* holes + 1];
-    myArray[0] = holes;
-
-    begin = 0;
-    int length;
-    int i = 0;
-    int atArray = 1;
-    while (begin + i < memR) {
-        if (get(begin) != 0)
-            begin++;
-        else {
-            i = 0;
-            length = 0;
-            while (!get(begin + i) && (begin + i < memR)) {
-                length++;
-                i++;
+    if (hi - lo == 1)
+        return searchGroup(lo, n, start, carry);
+    int64_t mid = (lo + hi) / 2;
+    int64_t output = searchNode(2 * node, lo, mid, n, start, carry);
+    return output != -1 ? output : searchNode(2 * node + 1, mid, hi, n, start, carry);
+}
+
+//searches one group's blocks using their hints, descending into a block's bits only where a fit can start
+int64_t MyBitMap::searchGroup(int64_t group, int64_t n, int64_t start, int64_t &carry) {
+    int64_t firstBlock = group * GROUP_BLOCKS;
+    int64_t lastBlock = min(firstBlock + GROUP_BLOCKS, memW);
+    for (int64_t block = firstBlock; block < lastBlock; block++) {
+        int64_t begin = block * BLOCK_WORDS;
+        if (begin + BLOCK_WORDS <= start)
+            continue;
+        if (begin >= start) {
+            if (carry + blockPrefix[block] >= n)
+                return begin - carry;
+            if (blockPrefix[block] == BLOCK_WORDS) {
+                carry += BLOCK_WORDS;
+                continue;
+            }
+            if (blockLongest[block] < n) {
+                carry = blockSuffix[block];
+                continue;
             }
-            myArray[atArray] = (uint16_t) begin;
-            myArray[atArray + 1] = (uint16_t) length;
-            begin += i;
-            i = 0;
-            atArray += 2;
         }
+        int64_t output = searchBlock(block, n, start, carry);
+        if (output != -1)
+            return output;
     }
-    return myArray;
+    //blocks past the end of the map are used
+    if (lastBlock < firstBlock + GROUP_BLOCKS)
+        carry = 0;
+    return -1;
 }
 
-//creates the format for the hex values needed
-uint8_t *MyBitMap::formatOutput() {
-    auto length = (uint16_t) ceil((double) memR / 8);
-    auto *myArray = new uint8_t[(int) ceil((double) memR / 8)+2];
-    for (int i = 0; i < (int) ceil((double) memR / 8) + 2; i++) {
-        myArray[i] = 0;
+//walks the free runs of one block from start, joining the first to carry
+int64_t MyBitMap::searchBlock(int64_t block, int64_t n, int64_t start, int64_t &carry) {
+    uint64_t bits = blockBits(block);
+    int64_t begin = block * BLOCK_WORDS;
+    int position = start > begin ? (int) (start - begin) : 0;
+    if (position > 0)
+        carry = 0;
+    while (position < 64) {
+        uint64_t free = ~bits & (~0ULL << position);
+        if (!free) {
+            carry = 0;
+            return -1;
+        }
+        int runBegin = __builtin_ctzll(free);
+        uint64_t used = bits & (~0ULL << runBegin);
+        int runEnd = used ? __builtin_ctzll(used) : 64;
+        int64_t runStart = runBegin == 0 ? begin - carry : begin + runBegin;
+        int64_t runLength = runBegin == 0 ? carry + runEnd : runEnd - runBegin;
+        if (runLength >= n)
+            return runStart;
+        if (runEnd == 64) {
+            carry = runLength;
+            return -1;
+        }
+        carry = 0;
+        position = runEnd;
     }
+    return -1;
+}
+
+//returns the number of free words, kept in step with the hole index
+int64_t MyBitMap::getFreeWords() {
+    return freeWords;
+}
+
+//returns the length of the largest hole, 0 if there is none
+int64_t MyBitMap::largestHole() {
+    return holesBySize.empty() ? 0 : holesBySize.rbegin()->first;
+}
+
+//returns the number of holes
+int64_t MyBitMap::holeCount() {
+    return (int64_t) holes.size();
+}
+
+//re-derives the hole index from the bits, for bits that were loaded wholesale rather than set through append
+void MyBitMap::rebuildHoles() {
+    holes.clear();
+    holesBySize.clear();
+    freeWords = 0;
+    int64_t begin, end = 0;
+    while (BitScan::nextRun(memBuf, memR, end, begin, end))
+        addHole(begin, end - begin);
+    buildSummary();
+    listStale = true;
+    wideStale = true;
+}
 
-    length = static_cast<uint16_t>((length << 8) | ((length >> 8) & 0x00ff));
-    myArray[0] = length >> 8;
-    myArray[1] = length & 0x0FF;
+//create an array of holes
+uint16_t *MyBitMap::ToList() {
+    const uint16_t *view = viewList();
+    size_t entries = 2 * (size_t) view[0] + 1;
+    auto * myArray = new uint16_t[entries];
+    memcpy(myArray, view, entries * sizeof(uint16_t));
+    return myArray;
+}
 
-    uint8_t count = 0;
-    int i = 0;
-    while(i < memR) {
-        if (get(i)) {
-            count += (uint8_t) pow(2, i % 8);
+//create the versioned hole list; see viewListWide for the layout
+uint64_t *MyBitMap::ToListWide() {
+    viewListWide();
+    auto * myArray = new uint64_t[wideView.size()];
+    memcpy(myArray, wideView.data(), wideView.size() * sizeof(uint64_t));
+    return myArray;
+}
+
+//returns the 16-bit hole list held by the bitmap, rebuilt only if the holes changed since the last call;
+//valid until the next append/release. A length field tops out at 65535, so the one hole that can be longer (a
+//free 65536-word arena) is listed as two adjacent entries.
+const uint16_t *MyBitMap::viewList() {
+    if (listStale) {
+        listView.resize(2 * holes.size() + 3);
+
+        size_t atArray = 1;
+        for (auto &hole : holes) {
+            for (int64_t begin = hole.first, end = hole.first + hole.second; begin < end; begin += UINT16_MAX) {
+                listView[atArray] = (uint16_t) begin;
+                listView[atArray + 1] = (uint16_t) std::min<int64_t>(end - begin, UINT16_MAX);
+                atArray += 2;
+            }
         }
-        if (((i + 1) % 8 == 0 && i != 0) || i == memR - 1) {
-            myArray[(i + 1) / 8 + 1] = myArray[(i + 1) / 8 + 1] ^ count;
-            count = 0;
+        listView[0] = (uint16_t) (atArray / 2);
+        listStale = false;
+    }
+    return listView.data();
+}
+
+//returns the wide hole list held by the bitmap: 32-bit fields while every offset fits, 64-bit beyond that;
+//rebuilt only if the holes changed and valid until the next append/release
+const uint64_t *MyBitMap::viewListWide() {
+    if (wideStale) {
+        uint16_t fieldBits = memR <= (int64_t) UINT32_MAX ? 32 : 64;
+        size_t headerWords = sizeof(WideHoleListHeader) / 8;
+        size_t bodyWords = fieldBits == 32 ? holes.size() : holes.size() * 2;
+        wideView.resize(headerWords + bodyWords);
+
+        auto *header = (WideHoleListHeader *) wideView.data();
+        memcpy(header->magic, WIDE_HOLE_LIST_MAGIC, sizeof(header->magic));
+        header->version = WIDE_HOLE_LIST_VERSION;
+        header->fieldBits = fieldBits;
+        header->holes = holes.size();
+
+        if (fieldBits == 32) {
+            auto *fields = (uint32_t *) (wideView.data() + headerWords);
+            for (auto &hole : holes) {
+                *fields++ = (uint32_t) hole.first;
+                *fields++ = (uint32_t) hole.second;
+            }
+        } else {
+            uint64_t *fields = wideView.data() + headerWords;
+            for (auto &hole : holes) {
+                *fields++ = (uint64_t) hole.first;
+                *fields++ = (uint64_t) hole.second;
+            }
         }
-        i++;
+        wideStale = false;
     }
-    return myArray;
+    return wideView.data();
 }
 
+//returns the hole index, ordered by start word
+const map<int64_t, int64_t> &MyBitMap::getHoles() {
+    return holes;
+}
 
+//creates the format for the hex values needed
+uint8_t *MyBitMap::formatOutput() {
+    int64_t bytes = (memR + 7) / 8;
+    auto *myArray = new uint8_t[bytes + 2];
+
+    //length is little-Endian
+    myArray[0] = bytes & 0x0FF;
+    myArray[1] = (bytes >> 8) & 0x0FF;
+
+    //bits past memR are never set, so the entries pack straight into bytes
+    BitScan::pack(memBuf, bytes, myArray + 2);
+    return myArray;
+}
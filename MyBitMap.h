@@ -9,27 +9,112 @@
 #include <iomanip>
 #include <math.h>
 #include <bitset>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <vector>
 #include <iostream>
+#include "BitScan.h"
 
 using namespace std;
 
+//Header of the wide hole list (see MyBitMap::ToListWide). All fields are little-Endian; the holes follow the
+//header as (offset, length) pairs of fieldBits each, offset and length in words.
+struct WideHoleListHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t fieldBits;
+    uint64_t holes;
+};
+
+const char WIDE_HOLE_LIST_MAGIC[4] = {'H', 'L', 'S', 'T'};
+const uint16_t WIDE_HOLE_LIST_VERSION = 1;
+
 class MyBitMap {
 public:
+    //words per summary block and blocks per summary group (see the run summary below)
+    static const int64_t BLOCK_WORDS = 64;
+    static const int64_t GROUP_BLOCKS = 64;
+
+    //free words at the start and end of a span, its longest free run and its length
+    struct RunSummary {
+        int64_t prefix, suffix, longest, length;
+    };
+
+public:
+    MyBitMap();
+    ~MyBitMap();
     void clear();
-    void setMyBitmap(unsigned n);
-    bool set(int n);
-    bool unset(int n);
-    int get(int n);
-    int getRange();
-    void append(int length, int offset);
-    void release(int length, int offset);
-    string getMemmap();
+    void setMyBitmap(size_t n);
+    void loadBits(size_t n, const uint64_t *bits);
+    void attachBits(size_t n, uint64_t *bits);
+    const uint64_t *getBits();
+    bool set(int64_t n);
+    bool unset(int64_t n);
+    int get(int64_t n);
+    int64_t getRange();
+    int64_t bestHole(int64_t n);
+    int64_t worstHole(int64_t n);
+    int64_t findFirstFit(int64_t n);
+    int64_t findNextFit(int64_t n, int64_t start);
+    int64_t getFreeWords();
+    int64_t largestHole();
+    int64_t holeCount();
+    void rebuildHoles();
+    const map<int64_t, int64_t> &getHoles();
+    void append(int64_t length, int64_t offset);
+    void release(int64_t length, int64_t offset);
     uint16_t * ToList();
+    uint64_t * ToListWide();
+    const uint16_t *viewList();
+    const uint64_t *viewListWide();
     uint8_t* formatOutput();
 
 private:
-    int* memBuf;
-    int memR;
+    void setRange(int64_t length, int64_t offset, bool used);
+    void carveHole(int64_t begin, int64_t end);
+    void mergeHole(int64_t begin, int64_t end);
+    void addHole(int64_t begin, int64_t length);
+    map<int64_t, int64_t>::iterator dropHole(map<int64_t, int64_t>::iterator hole);
+    uint64_t blockBits(int64_t block);
+    void summarizeBlock(int64_t block);
+    void summarizeGroup(int64_t group);
+    void buildSummary();
+    void refreshSummary();
+    int64_t findFit(int64_t n, int64_t start);
+    int64_t searchNode(int64_t node, int64_t lo, int64_t hi, int64_t n, int64_t start, int64_t &carry);
+    int64_t searchGroup(int64_t group, int64_t n, int64_t start, int64_t &carry);
+    int64_t searchBlock(int64_t block, int64_t n, int64_t start, int64_t &carry);
+
+    //one bit per managed word, 64 words per entry
+    uint64_t* memBuf;
+    //false while memBuf belongs to someone else (attachBits)
+    bool ownsBuf;
+    int64_t memR;
+    int64_t memW;
+    //free runs keyed by start word, value is the run length; kept in step with memBuf
+    map<int64_t, int64_t> holes;
+    //total length of the holes
+    int64_t freeWords;
+    //the same holes ordered by (length, start) for best/worst fit lookups
+    std::set<pair<int64_t, int64_t>> holesBySize;
+    //hole lists handed to allocator functions, rebuilt lazily after the holes change
+    vector<uint16_t> listView;
+    vector<uint64_t> wideView;
+    bool listStale;
+    bool wideStale;
+
+    //Run summary for first/next fit. Each 64-word block keeps one-byte hints (free words at its start and end,
+    //longest free run inside), updated with the bits. Groups of 64 blocks are the leaves of a tree of
+    //RunSummary nodes (node 1 is the root, node i has children 2i and 2i+1), so a search skips any subtree whose
+    //longest run is too short. Groups touched since the last search are only re-summarized when one is made.
+    vector<uint8_t> blockPrefix;
+    vector<uint8_t> blockSuffix;
+    vector<uint8_t> blockLongest;
+    vector<RunSummary> groupTree;
+    int64_t groupLeaves;
+    vector<int64_t> staleGroups;
+    vector<bool> groupStale;
 };
 
 
@@ -0,0 +1,186 @@
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+#include "MemoryManager.h"
+#include "Trace.h"
+
+using Clock = std::chrono::steady_clock;
+
+//one allocation policy to replay against: an allocator function, a wide allocator function or a built-in mode
+struct Policy {
+    const char *name;
+    std::function<int(int, void *)> allocator;
+    std::function<int64_t(int64_t, void *)> wideAllocator;
+    AllocatorMode mode;
+};
+
+//arena shape at one point of the replay
+struct Sample {
+    uint64_t event;
+    int64_t usedWords;
+    int64_t freeWords;
+    uint64_t holes;
+    int64_t largestHole;
+    double fragmentation;
+};
+
+//what one replay of the trace did
+struct Summary {
+    uint64_t events;
+    double seconds;
+    int64_t peakUsedWords;
+    uint64_t failed;
+    uint64_t failedInTrace;
+    vector<Sample> samples;
+};
+
+//describes the arena at one point of the replay
+static Sample sample(MemoryManager &memoryManager, uint64_t event) {
+    MemoryStats stats = memoryManager.getStats();
+    Sample s{event, stats.usedWords, stats.freeWords, (uint64_t) stats.holes, stats.largestHole, 0};
+    s.fragmentation = s.freeWords ? 1.0 - (double) s.largestHole / (double) s.freeWords : 0;
+    return s;
+}
+
+//Runs every event of the trace against policy, sampling the arena every interval events. Recorded offsets are
+//mapped to the blocks this replay handed out, so frees reach the right block whatever the policy placed.
+static bool replay(const char *filename, Policy &policy, uint64_t interval, Summary &summary) {
+    TraceReader reader;
+    if (!reader.open(filename))
+        return false;
+
+    std::unique_ptr<MemoryManager> memoryManager;
+    summary = Summary{0, 0, 0, 0, 0, {}};
+    std::unordered_map<int64_t, void *> blocks;
+    TraceEvent event;
+    auto start = Clock::now();
+    while (reader.next(event)) {
+        summary.events++;
+        switch (event.kind) {
+            case TraceKind::Initialize: {
+                //replays in the recorded word size so the same byte requests take the same words
+                memoryManager.reset(new MemoryManager(event.wordSize, policy.mode));
+                if (policy.mode == AllocatorMode::Callback)
+                    memoryManager->setAllocator(policy.allocator);
+                else if (policy.mode == AllocatorMode::WideCallback)
+                    memoryManager->setWideAllocator(policy.wideAllocator);
+                memoryManager->initialize((size_t) event.size);
+                blocks.clear();
+                break;
+            }
+            case TraceKind::Allocate: {
+                void *block = memoryManager ? memoryManager->allocate((size_t) event.size) : nullptr;
+                if (event.offset == -1)
+                    summary.failedInTrace++;
+                if (!block) {
+                    summary.failed++;
+                    break;
+                }
+                //getStats is O(1), so the peak is exact rather than sampled
+                summary.peakUsedWords = max(summary.peakUsedWords, memoryManager->getStats().usedWords);
+                if (event.offset != -1)
+                    blocks[event.offset] = block;
+                break;
+            }
+            case TraceKind::Free: {
+                auto it = blocks.find(event.offset);
+                if (it != blocks.end()) {
+                    memoryManager->free(it->second);
+                    blocks.erase(it);
+                }
+                break;
+            }
+        }
+        if (memoryManager && summary.events % interval == 0) {
+            summary.seconds += std::chrono::duration<double>(Clock::now() - start).count();
+            summary.samples.push_back(sample(*memoryManager, summary.events));
+            start = Clock::now();
+        }
+    }
+    summary.seconds += std::chrono::duration<double>(Clock::now() - start).count();
+    if (memoryManager) {
+        summary.samples.push_back(sample(*memoryManager, summary.events));
+        memoryManager->shutdown();
+    }
+    return true;
+}
+
+//usage: replay TRACE [POLICY | all] [--interval N] [--csv]
+int main(int argc, char **argv) {
+    vector<Policy> policies = {
+            {"bestFit",        bestFit,  nullptr,      AllocatorMode::Callback},
+            {"worstFit",       worstFit, nullptr,      AllocatorMode::Callback},
+            {"firstFit",       firstFit, nullptr,      AllocatorMode::Callback},
+            {"bestFitWide",    nullptr,  bestFitWide,  AllocatorMode::WideCallback},
+            {"worstFitWide",   nullptr,  worstFitWide, AllocatorMode::WideCallback},
+            {"firstFitWide",   nullptr,  firstFitWide, AllocatorMode::WideCallback},
+            {"Mode::BestFit",  nullptr,  nullptr,      AllocatorMode::BestFit},
+            {"Mode::WorstFit", nullptr,  nullptr,      AllocatorMode::WorstFit},
+            {"Mode::FirstFit", nullptr,  nullptr,      AllocatorMode::FirstFit},
+            {"Mode::NextFit",  nullptr,  nullptr,      AllocatorMode::NextFit},
+            {"Mode::Tlsf",     nullptr,  nullptr,      AllocatorMode::Tlsf},
+            {"Mode::Buddy",    nullptr,  nullptr,      AllocatorMode::Buddy},
+    };
+
+    const char *filename = nullptr;
+    string policyName = "all";
+    uint64_t interval = 10000;
+    bool csv = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--csv")
+            csv = true;
+        else if (arg == "--interval" && i + 1 < argc)
+            interval = max<uint64_t>(1, strtoull(argv[++i], nullptr, 10));
+        else if (!filename)
+            filename = argv[i];
+        else
+            policyName = arg;
+    }
+    if (!filename) {
+        std::cerr << "usage: " << argv[0] << " TRACE [POLICY | all] [--interval N] [--csv]" << std::endl
+                  << "policies:";
+        for (auto &policy : policies)
+            std::cerr << " " << policy.name;
+        std::cerr << std::endl;
+        return 2;
+    }
+
+    if (csv)
+        std::cout << "policy,event,used_words,free_words,holes,largest_hole,fragmentation" << std::endl;
+    bool matched = false;
+    for (auto &policy : policies) {
+        if (policyName != "all" && policyName != policy.name)
+            continue;
+        matched = true;
+        Summary summary;
+        if (!replay(filename, policy, interval, summary)) {
+            std::cerr << filename << ": not a readable trace" << std::endl;
+            return 1;
+        }
+
+        if (csv) {
+            for (auto &s : summary.samples)
+                std::cout << policy.name << "," << s.event << "," << s.usedWords << "," << s.freeWords << ","
+                          << s.holes << "," << s.largestHole << "," << std::setprecision(4) << s.fragmentation
+                          << std::endl;
+            continue;
+        }
+        std::cout << policy.name << ": " << summary.events << " events, " << std::fixed << std::setprecision(0)
+                  << (summary.seconds > 0 ? summary.events / summary.seconds : 0) << " events/s, peak "
+                  << summary.peakUsedWords << " words used, " << summary.failed << " failed allocations ("
+                  << summary.failedInTrace << " in the trace)" << std::endl;
+        std::cout << "  " << std::left << std::setw(12) << "event" << std::setw(12) << "used" << std::setw(12)
+                  << "free" << std::setw(10) << "holes" << std::setw(12) << "largest" << "fragmentation" << std::endl;
+        for (auto &s : summary.samples)
+            std::cout << "  " << std::setw(12) << s.event << std::setw(12) << s.usedWords << std::setw(12)
+                      << s.freeWords << std::setw(10) << s.holes << std::setw(12) << s.largestHole
+                      << std::setprecision(4) << s.fragmentation << std::setprecision(0) << std::endl;
+        std::cout << std::right;
+    }
+    if (!matched) {
+        std::cerr << "unknown policy " << policyName << std::endl;
+        return 2;
+    }
+    return 0;
+}
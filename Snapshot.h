@@ -0,0 +1,28 @@
+#ifndef OFFICIALMEMORYMANAGER_SNAPSHOT_H
+#define OFFICIALMEMORYMANAGER_SNAPSHOT_H
+
+#include <cstdint>
+
+//Snapshot file layout: SnapshotHeader, then the bitmap as (words + 63) / 64 64-bit words (bit i of word i / 64 set
+//= word i in use), then records (offset, length) pairs of int64_t, in words, one per live block, then with
+//SNAPSHOT_CONTENTS the arena's words * wordSize bytes. Integers are in the writer's byte order, which byteOrder
+//records so a machine of the other order refuses the file.
+struct SnapshotHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t byteOrder;
+    uint32_t wordSize;
+    uint32_t flags;
+    int64_t words;
+    int64_t records;
+};
+
+const char SNAPSHOT_MAGIC[4] = {'M', 'S', 'N', 'P'};
+const uint16_t SNAPSHOT_VERSION = 1;
+const uint16_t SNAPSHOT_BYTE_ORDER = 0x0102;
+
+//flags
+const uint32_t SNAPSHOT_CONTENTS = 1;
+
+
+#endif //OFFICIALMEMORYMANAGER_SNAPSHOT_H
@@ -0,0 +1,252 @@
+#include "MemoryManager.h"
+#include "ArenaSet.h"
+#include <random>
+
+//Regression tests (make test); each returns true when the behaviour holds.
+
+static int failures = 0;
+
+static void check(bool passed, const char *name) {
+    std::cout << (passed ? "[CORRECT] " : "[INCORRECT] ") << name << std::endl;
+    if (!passed)
+        failures++;
+}
+
+//Small blocks freed in thread-safe mode park in the thread caches; a request only the parked words can satisfy
+//must still succeed.
+static bool testCachedWordsReused() {
+    MemoryManager memoryManager(8, AllocatorMode::BestFit);
+    memoryManager.setThreadSafe(true);
+    memoryManager.initialize(64);
+    void *first = memoryManager.allocate(8 * 8);
+    void *second = memoryManager.allocate(8 * 8);
+    memoryManager.free(first);
+    memoryManager.free(second);
+    MemoryStats stats = memoryManager.getStats();
+    if (stats.freeWords != 48 || stats.cachedWords != 16)
+        return false;
+    void *whole = memoryManager.allocate(64 * 8);
+    if (whole == nullptr)
+        return false;
+    memoryManager.free(whole);
+    return memoryManager.allocate(60 * 8) != nullptr;
+}
+
+//The same through ArenaSet, whose arenas all run thread-safe
+static bool testArenaSetCachedWordsReused() {
+    ArenaSet arenas(8, 1, AllocatorMode::BestFit);
+    arenas.initialize(64);
+    void *first = arenas.allocate(8 * 8);
+    void *second = arenas.allocate(8 * 8);
+    arenas.free(first);
+    arenas.free(second);
+    return arenas.allocate(64 * 8) != nullptr;
+}
+
+//An arena too large to allocate is refused with false and leaves the manager usable
+static bool testOversizedArenaRefused() {
+    MemoryManager memoryManager(8, AllocatorMode::BestFit);
+    if (memoryManager.initialize((size_t) MAX_WORDS))
+        return false;
+    ArenaSet arenas(8, 1, AllocatorMode::BestFit);
+    if (arenas.initialize((size_t) MAX_WORDS))
+        return false;
+    return memoryManager.initialize(64) && memoryManager.allocate(64 * 8) != nullptr;
+}
+
+//Dumps whose hole list spans several copy batches come out whole, in both formats
+static bool testDumpSpansBatches() {
+    const int64_t holeCount = 10000;
+    MemoryManager memoryManager(8, AllocatorMode::FirstFit);
+    memoryManager.initialize((size_t) (2 * holeCount));
+    vector<void *> blocks;
+    for (int64_t i = 0; i < 2 * holeCount; i++)
+        blocks.push_back(memoryManager.allocate(8));
+    for (int64_t i = 0; i < 2 * holeCount; i += 2)
+        memoryManager.free(blocks[i]);
+
+    char filename[] = "/tmp/testsDumpXXXXXX";
+    int fd = mkstemp(filename);
+    if (fd == -1)
+        return false;
+    bool whole = memoryManager.dumpMemoryMap(fd, DumpFormat::Binary) == 0;
+    WideHoleListHeader header{};
+    whole = whole && pread(fd, &header, sizeof header, 0) == (ssize_t) sizeof header && header.holes == holeCount;
+    for (int64_t i = 0; whole && i < holeCount; i++) {
+        uint64_t fields[2];
+        whole = pread(fd, fields, sizeof fields, (off_t) (sizeof header + i * sizeof fields)) == sizeof fields
+                && fields[0] == (uint64_t) (2 * i) && fields[1] == 1;
+    }
+    close(fd);
+
+    whole = whole && memoryManager.dumpMemoryMap(filename) == 0;
+    string text;
+    char chunk[4096];
+    fd = open(filename, O_RDONLY);
+    for (ssize_t got; fd != -1 && (got = read(fd, chunk, sizeof chunk)) > 0;)
+        text.append(chunk, (size_t) got);
+    close(fd);
+    unlink(filename);
+    return whole && (int64_t) std::count(text.begin(), text.end(), '[') == holeCount
+           && text.compare(0, 16, "[0, 1] - [2, 1] ") == 0
+           && text.compare(text.size() - 10, 10, "[19998, 1]") == 0;
+}
+
+//A start bit left on free words by a writer that died mid-free must not split a block later allocated over it
+static bool testStaleStartBitCleared() {
+    const int64_t words = 64;
+    char filename[] = "/tmp/testsArenaXXXXXX";
+    int fd = mkstemp(filename);
+    if (fd == -1)
+        return false;
+    close(fd);
+    unlink(filename);
+    MemoryManager memoryManager(8, AllocatorMode::FirstFit);
+    if (!memoryManager.initialize(filename, (size_t) words, false))
+        return false;
+    memoryManager.shutdown();
+
+    //start bit at word 5 while every word is free
+    uint64_t startBits = 1ULL << 5;
+    fd = open(filename, O_RDWR);
+    bool planted = pwrite(fd, &startBits, sizeof startBits,
+                          (off_t) (arenaFileBitsOffset(0) + (words + 63) / 64 * sizeof(uint64_t))) == sizeof startBits;
+    close(fd);
+
+    bool sound = planted && memoryManager.initialize(filename, 0, false)
+                 && memoryManager.getWordOffset(memoryManager.allocate(10 * 8)) == 0;
+    memoryManager.shutdown();
+    sound = sound && memoryManager.initialize(filename, 0, false) && memoryManager.getStats().liveAllocations == 1;
+    memoryManager.free(memoryManager.getAddress(0));
+    sound = sound && memoryManager.getStats().freeWords == words;
+    memoryManager.shutdown();
+    unlink(filename);
+    return sound;
+}
+
+//A free 65536-word arena shows in the 16-bit list as two holes the legacy allocators can use, and a request for
+//every word still fits
+static bool testLegacyFullArena() {
+    MemoryManager memoryManager(8, bestFit);
+    memoryManager.initialize((size_t) LEGACY_MAX_WORDS);
+    auto *list = (uint16_t *) memoryManager.getList();
+    bool listed = list && list[0] == 2 && list[1] == 0 && list[2] == 65535 && list[3] == 65535 && list[4] == 1;
+    delete[] list;
+    void *whole = memoryManager.allocate((size_t) LEGACY_MAX_WORDS * 8);
+    memoryManager.free(whole);
+    memoryManager.setAllocator(worstFit);
+    return listed && whole != nullptr && memoryManager.allocate(8 * 8) != nullptr;
+}
+
+//Snapshots whose records overlap or cover free words are refused; the untouched snapshot loads
+static bool testUnsoundSnapshotRefused() {
+    char filename[] = "/tmp/testsSnapshotXXXXXX";
+    int fd = mkstemp(filename);
+    if (fd == -1)
+        return false;
+    close(fd);
+    MemoryManager memoryManager(8, AllocatorMode::FirstFit);
+    memoryManager.initialize(64);
+    memoryManager.allocate(8 * 8);
+    memoryManager.allocate(8 * 8);
+    bool sound = memoryManager.saveSnapshot(filename, false);
+
+    //the records follow the header and one bitmap word; move the block at 8 onto the other, then stretch it
+    //over free words
+    off_t recordsAt = (off_t) (sizeof(SnapshotHeader) + sizeof(uint64_t));
+    int64_t records[4];
+    fd = open(filename, O_RDWR);
+    sound = sound && pread(fd, records, sizeof records, recordsAt) == sizeof records;
+    int at = records[0] == 8 ? 0 : 2;
+    records[at] = 4;
+    sound = sound && pwrite(fd, records, sizeof records, recordsAt) == sizeof records;
+    bool overlapRefused = !memoryManager.loadSnapshot(filename);
+    records[at] = 8;
+    records[at + 1] = 20;
+    sound = sound && pwrite(fd, records, sizeof records, recordsAt) == sizeof records;
+    bool freeRefused = !memoryManager.loadSnapshot(filename);
+    records[at + 1] = 8;
+    sound = sound && pwrite(fd, records, sizeof records, recordsAt) == sizeof records;
+    close(fd);
+    sound = sound && memoryManager.loadSnapshot(filename) && memoryManager.getStats().liveAllocations == 2;
+    unlink(filename);
+    return sound && overlapRefused && freeRefused;
+}
+
+//the holes a manager sees, as its hole list
+static vector<uint16_t> holesOf(MemoryManager &memoryManager) {
+    auto *list = (uint16_t *) memoryManager.getList();
+    vector<uint16_t> holes(list, list + 2 * list[0] + 1);
+    delete[] list;
+    return holes;
+}
+
+//Managers in different modes sharing one arena replay each other's changes into the same view a fresh attach
+//builds, including after one falls further behind than the change log reaches, and their engines hand out every
+//free word exactly once
+static bool testSharedReplay() {
+    string name = "/testsShared" + std::to_string(getpid());
+    MemoryManager::unlinkShared(name.c_str());
+    MemoryManager tlsf(8, AllocatorMode::Tlsf), firstFit(8, AllocatorMode::FirstFit), buddy(8, AllocatorMode::Buddy);
+    MemoryManager *managers[3] = {&tlsf, &firstFit, &buddy};
+    bool sound = tlsf.initializeShared(name.c_str(), 4096) && firstFit.initializeShared(name.c_str(), 0) &&
+                 buddy.initializeShared(name.c_str(), 0);
+
+    std::mt19937 rng(7);
+    vector<int64_t> live;
+    for (int round = 0; sound && round < 3; round++) {
+        //the last round leaves the buddy manager out for longer than the log reaches
+        int turns = round == 2 ? (int) SHARED_LOG_ENTRIES * 2 : 2000;
+        for (int i = 0; i < turns; i++) {
+            MemoryManager &by = *managers[round == 2 ? rng() % 2 : rng() % 3];
+            if (live.empty() || rng() % 3) {
+                void *block = by.allocate((1 + rng() % 24) * 8);
+                if (block)
+                    live.push_back(by.getWordOffset(block));
+            } else {
+                size_t pick = rng() % live.size();
+                if (rng() % 2)
+                    by.free(by.getAddress(live[pick]));
+                else if (!by.reallocate(by.getAddress(live[pick]), (1 + rng() % 24) * 8))
+                    continue;
+                //a resized block stays allocated, just no longer picked
+                live[pick] = live.back();
+                live.pop_back();
+            }
+        }
+        MemoryManager fresh(8, AllocatorMode::FirstFit);
+        sound = fresh.initializeShared(name.c_str(), 0);
+        vector<uint16_t> expected = holesOf(fresh);
+        for (MemoryManager *memoryManager : managers)
+            sound = sound && holesOf(*memoryManager) == expected &&
+                    memoryManager->getStats().liveAllocations == fresh.getStats().liveAllocations;
+        fresh.shutdown();
+    }
+
+    //one word at a time until nothing is left must take exactly the free words
+    for (MemoryManager *memoryManager : {&tlsf, &buddy}) {
+        int64_t freeWords = memoryManager->getStats().freeWords;
+        vector<int64_t> taken;
+        for (void *block; sound && (block = memoryManager->allocate(8)) != nullptr;)
+            taken.push_back(memoryManager->getWordOffset(block));
+        sound = sound && (int64_t) taken.size() == freeWords && firstFit.getStats().freeWords == 0;
+        for (int64_t wordOffset : taken)
+            firstFit.free(firstFit.getAddress(wordOffset));
+    }
+    for (MemoryManager *memoryManager : managers)
+        memoryManager->shutdown();
+    MemoryManager::unlinkShared(name.c_str());
+    return sound;
+}
+
+int main() {
+    check(testCachedWordsReused(), "cached words are reused when the core runs out");
+    check(testArenaSetCachedWordsReused(), "ArenaSet reuses cached words when the core runs out");
+    check(testOversizedArenaRefused(), "oversized arenas are refused with false");
+    check(testDumpSpansBatches(), "dumps spanning several hole batches are complete");
+    check(testStaleStartBitCleared(), "stale start bits on free words are cleared on attach");
+    check(testLegacyFullArena(), "a free 65536-word arena works with the 16-bit list");
+    check(testUnsoundSnapshotRefused(), "snapshots with overlapping or free records are refused");
+    check(testSharedReplay(), "processes sharing an arena replay each other's changes");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,23 @@
+#ifndef OFFICIALMEMORYMANAGER_THREADCACHE_H
+#define OFFICIALMEMORYMANAGER_THREADCACHE_H
+
+#include <mutex>
+#include <vector>
+#include "AllocTable.h"
+
+//Recently freed small blocks kept for one thread so most allocate/free pairs never take the manager's core lock.
+//Cached blocks stay allocated in the core; the slot lock is only ever contended by cross-thread frees.
+struct ThreadCache {
+    static const int SLOTS = 16;
+    static const int SMALL_WORDS = 32;
+    static const int BIN_DEPTH = 32;
+
+    std::mutex lock;
+    //blocks this slot has handed out: offset -> length
+    AllocTable owned;
+    //free blocks ready for reuse, by length in words
+    std::vector<int64_t> bins[SMALL_WORDS + 1];
+};
+
+
+#endif //OFFICIALMEMORYMANAGER_THREADCACHE_H
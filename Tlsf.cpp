@@ -0,0 +1,155 @@
+#include "Tlsf.h"
+
+//Constructor; starts with no free blocks
+Tlsf::Tlsf() {
+    clear();
+}
+
+//Forgets every free block
+void Tlsf::clear() {
+    flBitmap = 0;
+    for (int fl = 0; fl < FL_COUNT; fl++) {
+        slBitmap[fl] = 0;
+        for (int sl = 0; sl < SL_COUNT; sl++)
+            heads[fl][sl] = -1;
+    }
+    nodes.clear();
+    freeNodes.clear();
+    startIndex.clear();
+    endIndex.clear();
+}
+
+//Returns the offset of a free block of at least length words, splitting off the rest, or -1 if there is none.
+//O(1) unless only the request's own size class can serve it (see the class comment).
+int64_t Tlsf::allocate(int64_t length) {
+    if (length <= 0)
+        return -1;
+
+    //round up to the next class boundary so any block in the class found is large enough
+    int64_t rounded = length;
+    int msb = 63 - __builtin_clzll((uint64_t) rounded);
+    if (msb >= SL_LOG2)
+        rounded += (1LL << (msb - SL_LOG2)) - 1;
+    int fl, sl;
+    mapping(rounded, fl, sl);
+    uint32_t slMap = slBitmap[fl] & (~0U << sl);
+    if (!slMap) {
+        uint64_t flMap = fl + 1 < FL_COUNT ? flBitmap & (~0ULL << (fl + 1)) : 0;
+        if (flMap) {
+            fl = __builtin_ctzll(flMap);
+            slMap = slBitmap[fl];
+        }
+    }
+    if (slMap)
+        return takeFrom(fl, __builtin_ctz(slMap), length);
+
+    //nothing in a larger class; blocks in the request's own class may still be big enough
+    mapping(length, fl, sl);
+    for (int n = heads[fl][sl]; n != -1; n = nodes[n].next) {
+        if (nodes[n].length >= length)
+            return takeFrom(fl, sl, length);
+    }
+    return -1;
+}
+
+//Returns [offset, offset + length) to the free lists, merging with a free block on either side.
+void Tlsf::addFree(int64_t length, int64_t offset) {
+    if (length <= 0)
+        return;
+
+    int before = (int) endIndex.getSizeOffset(offset);
+    if (before != -1) {
+        offset = nodes[before].offset;
+        length += nodes[before].length;
+        remove(before);
+    }
+    int after = (int) startIndex.getSizeOffset(offset + length);
+    if (after != -1) {
+        length += nodes[after].length;
+        remove(after);
+    }
+    insert(length, offset);
+}
+
+//Takes [offset, offset + length) from the front of the free block starting at offset, for growing the block
+//that ends there in place; returns false if no free block starts at offset or it is too short.
+bool Tlsf::takeAt(int64_t length, int64_t offset) {
+    int n = (int) startIndex.getSizeOffset(offset);
+    if (n == -1 || nodes[n].length < length)
+        return false;
+    int64_t remaining = nodes[n].length - length;
+    remove(n);
+    if (remaining > 0)
+        insert(remaining, offset + length);
+    return true;
+}
+
+//first level is the highest set bit, second level the next SL_LOG2 bits; blocks under SL_COUNT share fl 0
+void Tlsf::mapping(int64_t length, int &fl, int &sl) {
+    if (length < SL_COUNT) {
+        fl = 0;
+        sl = (int) length;
+        return;
+    }
+    int msb = 63 - __builtin_clzll((uint64_t) length);
+    fl = msb - SL_LOG2 + 1;
+    sl = (int) ((length >> (msb - SL_LOG2)) ^ SL_COUNT);
+}
+
+//puts a free block at the head of its class list
+void Tlsf::insert(int64_t length, int64_t offset) {
+    int n;
+    if (freeNodes.empty()) {
+        n = (int) nodes.size();
+        nodes.push_back(Node());
+    } else {
+        n = freeNodes.back();
+        freeNodes.pop_back();
+    }
+    int fl, sl;
+    mapping(length, fl, sl);
+    nodes[n].offset = offset;
+    nodes[n].length = length;
+    nodes[n].prev = -1;
+    nodes[n].next = heads[fl][sl];
+    if (heads[fl][sl] != -1)
+        nodes[heads[fl][sl]].prev = n;
+    heads[fl][sl] = n;
+    flBitmap |= 1ULL << fl;
+    slBitmap[fl] |= 1U << sl;
+    startIndex.addEntry(n, offset);
+    endIndex.addEntry(n, offset + length);
+}
+
+//unlinks a free block from its class list and the boundary indexes
+void Tlsf::remove(int n) {
+    int fl, sl;
+    mapping(nodes[n].length, fl, sl);
+    if (nodes[n].prev != -1)
+        nodes[nodes[n].prev].next = nodes[n].next;
+    else
+        heads[fl][sl] = nodes[n].next;
+    if (nodes[n].next != -1)
+        nodes[nodes[n].next].prev = nodes[n].prev;
+    if (heads[fl][sl] == -1) {
+        slBitmap[fl] &= ~(1U << sl);
+        if (!slBitmap[fl])
+            flBitmap &= ~(1ULL << fl);
+    }
+    startIndex.deleteEntry(nodes[n].offset);
+    endIndex.deleteEntry(nodes[n].offset + nodes[n].length);
+    freeNodes.push_back(n);
+}
+
+//takes the first block of at least length words from class (fl, sl) and returns its unused tail
+int64_t Tlsf::takeFrom(int fl, int sl, int64_t length) {
+    int n = heads[fl][sl];
+    while (nodes[n].length < length)
+        n = nodes[n].next;
+    int64_t offset = nodes[n].offset;
+    int64_t remaining = nodes[n].length - length;
+    remove(n);
+    if (remaining > 0)
+        insert(remaining, offset + length);
+    return offset;
+}
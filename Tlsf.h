@@ -0,0 +1,49 @@
+#ifndef OFFICIALMEMORYMANAGER_TLSF_H
+#define OFFICIALMEMORYMANAGER_TLSF_H
+
+#include <cstdint>
+#include <vector>
+#include "AllocTable.h"
+
+//Two-level segregated fit over word offsets: free blocks live in size-class lists found through two bitmaps and
+//free neighbours are merged immediately. addFree is O(1), and so is allocate whenever a class above the request's
+//has a block; when only the request's own class might, allocate walks that class's list rather than fail a
+//request a free block could serve, so it is O(blocks in that class) there.
+class Tlsf {
+public:
+    static const int SL_LOG2 = 4;
+    static const int SL_COUNT = 1 << SL_LOG2;
+    static const int FL_COUNT = 64;
+
+    struct Node {
+        int64_t offset, length;
+        int prev, next;
+    };
+
+public:
+    Tlsf();
+    void clear();
+    int64_t allocate(int64_t length);
+    void addFree(int64_t length, int64_t offset);
+    bool takeAt(int64_t length, int64_t offset);
+
+private:
+    void mapping(int64_t length, int &fl, int &sl);
+    void insert(int64_t length, int64_t offset);
+    void remove(int node);
+    int64_t takeFrom(int fl, int sl, int64_t length);
+
+    uint64_t flBitmap;
+    uint32_t slBitmap[FL_COUNT];
+    int heads[FL_COUNT][SL_COUNT];
+
+    //free blocks; released nodes are recycled through freeNodes
+    std::vector<Node> nodes;
+    std::vector<int> freeNodes;
+    //block start -> node and block end -> node, for finding neighbours without touching the arena
+    AllocTable startIndex;
+    AllocTable endIndex;
+};
+
+
+#endif //OFFICIALMEMORYMANAGER_TLSF_H
@@ -0,0 +1,206 @@
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include "Trace.h"
+
+//Constructor; nothing is written until open is called
+TraceWriter::TraceWriter() {
+    fd = -1;
+    buffer = new uint8_t[BUFFER_BYTES];
+    used = 0;
+}
+
+//Destructor; writes out anything still buffered
+TraceWriter::~TraceWriter() {
+    close();
+    delete[] buffer;
+}
+
+//creates filename and writes the file header, returning false if the file cannot be written
+bool TraceWriter::open(const char *filename) {
+    std::lock_guard<std::mutex> guard(lock);
+    fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        return false;
+    TraceFileHeader header;
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.reserved = 0;
+    memcpy(buffer, &header, sizeof(header));
+    used = sizeof(header);
+    last = std::chrono::steady_clock::now();
+    return true;
+}
+
+//writes out the buffer and closes the file
+void TraceWriter::close() {
+    std::lock_guard<std::mutex> guard(lock);
+    if (fd == -1)
+        return;
+    flush();
+    ::close(fd);
+    fd = -1;
+}
+
+void TraceWriter::recordInitialize(int64_t words, unsigned wordSize) {
+    put(TraceKind::Initialize, (uint64_t) words, wordSize, true);
+}
+
+//wordOffset is -1 when the allocation failed
+void TraceWriter::recordAllocate(size_t sizeInBytes, int64_t wordOffset) {
+    put(TraceKind::Allocate, sizeInBytes, (uint64_t) (wordOffset + 1), true);
+}
+
+void TraceWriter::recordFree(int64_t wordOffset) {
+    put(TraceKind::Free, (uint64_t) wordOffset, 0, false);
+}
+
+//appends one record, flushing first if it might not fit; the clock is read under the lock so deltas never go back
+void TraceWriter::put(TraceKind kind, uint64_t first, uint64_t second, bool hasSecond) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (fd == -1)
+        return;
+    //kind byte plus at most three 10-byte varints
+    if (used + 31 > BUFFER_BYTES)
+        flush();
+    auto now = std::chrono::steady_clock::now();
+    buffer[used++] = (uint8_t) kind;
+    putVarint((uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count());
+    last = now;
+    putVarint(first);
+    if (hasSecond)
+        putVarint(second);
+}
+
+void TraceWriter::putVarint(uint64_t value) {
+    while (value >= 0x80) {
+        buffer[used++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    buffer[used++] = (uint8_t) value;
+}
+
+//writes the whole buffer, retrying short writes; a failed write closes the trace rather than the program
+void TraceWriter::flush() {
+    size_t done = 0;
+    while (done < used) {
+        ssize_t written = ::write(fd, buffer + done, used - done);
+        if (written == -1 && errno == EINTR)
+            continue;
+        if (written <= 0) {
+            ::close(fd);
+            fd = -1;
+            break;
+        }
+        done += (size_t) written;
+    }
+    used = 0;
+}
+
+//Constructor; nothing is read until open is called
+TraceReader::TraceReader() {
+    fd = -1;
+    buffer = new uint8_t[BUFFER_BYTES];
+    used = 0;
+    at = 0;
+    nanos = 0;
+}
+
+//Destructor; closes the file if still open
+TraceReader::~TraceReader() {
+    close();
+    delete[] buffer;
+}
+
+//opens filename and checks its header, returning false if it is not a trace this version can read
+bool TraceReader::open(const char *filename) {
+    close();
+    fd = ::open(filename, O_RDONLY);
+    if (fd == -1)
+        return false;
+    used = 0;
+    at = 0;
+    nanos = 0;
+
+    TraceFileHeader header;
+    auto *bytes = (uint8_t *) &header;
+    for (size_t i = 0; i < sizeof(header); i++) {
+        if (!getByte(bytes[i])) {
+            close();
+            return false;
+        }
+    }
+    if (memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 || header.version != TRACE_VERSION) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void TraceReader::close() {
+    if (fd != -1)
+        ::close(fd);
+    fd = -1;
+}
+
+//decodes the next record, returning false at the end of the file or on a truncated or unknown record
+bool TraceReader::next(TraceEvent &event) {
+    uint8_t kind;
+    uint64_t delta, first, second = 0;
+    if (!getByte(kind) || !getVarint(delta) || !getVarint(first))
+        return false;
+    if (kind != (uint8_t) TraceKind::Free && !getVarint(second))
+        return false;
+
+    nanos += delta;
+    event.kind = (TraceKind) kind;
+    event.nanos = nanos;
+    event.wordSize = 0;
+    switch (event.kind) {
+        case TraceKind::Initialize:
+            event.size = (int64_t) first;
+            event.offset = -1;
+            event.wordSize = (unsigned) second;
+            return true;
+        case TraceKind::Allocate:
+            event.size = (int64_t) first;
+            event.offset = (int64_t) second - 1;
+            return true;
+        case TraceKind::Free:
+            event.size = 0;
+            event.offset = (int64_t) first;
+            return true;
+    }
+    return false;
+}
+
+bool TraceReader::getByte(uint8_t &value) {
+    if (at == used) {
+        if (fd == -1)
+            return false;
+        ssize_t got;
+        do
+            got = ::read(fd, buffer, BUFFER_BYTES);
+        while (got == -1 && errno == EINTR);
+        if (got <= 0)
+            return false;
+        used = (size_t) got;
+        at = 0;
+    }
+    value = buffer[at++];
+    return true;
+}
+
+bool TraceReader::getVarint(uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t byte;
+        if (!getByte(byte))
+            return false;
+        value |= (uint64_t) (byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
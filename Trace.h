@@ -0,0 +1,84 @@
+#ifndef OFFICIALMEMORYMANAGER_TRACE_H
+#define OFFICIALMEMORYMANAGER_TRACE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <mutex>
+
+//Trace file layout: TraceFileHeader, then one record per event. A record is a kind byte followed by LEB128
+//varints: nanoseconds since the previous record, then
+//  Initialize: arena words, word size
+//  Allocate:   requested bytes, returned word offset + 1 (0 when the allocation failed)
+//  Free:       word offset
+struct TraceFileHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t reserved;
+};
+
+const char TRACE_MAGIC[4] = {'M', 'T', 'R', 'C'};
+const uint16_t TRACE_VERSION = 1;
+
+enum class TraceKind : uint8_t { Initialize = 1, Allocate = 2, Free = 3 };
+
+//one decoded record; nanos counts from the start of the trace
+struct TraceEvent {
+    TraceKind kind;
+    uint64_t nanos;
+    int64_t size;
+    int64_t offset;
+    unsigned wordSize;
+};
+
+//Buffers records and writes them out a block at a time; safe to share between threads.
+class TraceWriter {
+public:
+    static const size_t BUFFER_BYTES = 1 << 16;
+
+public:
+    TraceWriter();
+    ~TraceWriter();
+    bool open(const char *filename);
+    void close();
+    void recordInitialize(int64_t words, unsigned wordSize);
+    void recordAllocate(size_t sizeInBytes, int64_t wordOffset);
+    void recordFree(int64_t wordOffset);
+
+private:
+    void put(TraceKind kind, uint64_t first, uint64_t second, bool hasSecond);
+    void putVarint(uint64_t value);
+    void flush();
+
+    int fd;
+    std::mutex lock;
+    std::chrono::steady_clock::time_point last;
+    uint8_t *buffer;
+    size_t used;
+};
+
+//Reads a trace file back one event at a time.
+class TraceReader {
+public:
+    static const size_t BUFFER_BYTES = 1 << 16;
+
+public:
+    TraceReader();
+    ~TraceReader();
+    bool open(const char *filename);
+    void close();
+    bool next(TraceEvent &event);
+
+private:
+    bool getByte(uint8_t &value);
+    bool getVarint(uint64_t &value);
+
+    int fd;
+    uint8_t *buffer;
+    size_t used;
+    size_t at;
+    uint64_t nanos;
+};
+
+
+#endif //OFFICIALMEMORYMANAGER_TRACE_H